@@ -0,0 +1,560 @@
+//
+//  Entities: the enemies, hazards and other objects placed in a level by
+//  their glyphs ('P' patrollers, '|' and 'x' hazards, ...).
+//
+//  Entities with the same components share an archetype, which stores each
+//  component as its own array (x[], y[], vx[], ...). Updates are loops over
+//  the archetypes that have the components they need, and within one a
+//  straight loop over contiguous floats with no per-entity branches, so
+//  thousands of entities cost a few microseconds per tick. An entity is a
+//  row of its archetype.
+//
+//  A glyph is turned into an entity of its kind (archetype, size, patrol
+//  speed and range) with iAddEntityKind(), and a whole level is spawned with
+//  iSpawnLevelEntities() or iSpawnStreamEntities().
+//
+//  On long levels, sort the archetypes by position once they are spawned
+//  (iSortEntities) and update with iUpdateEntitiesAround(): only entities
+//  near the view are found (by binary search) and moved, those a little
+//  further away every few ticks, and the rest not at all. Each entity
+//  remembers the tick it was last moved and catches up exactly when it is
+//  moved again, so the cost per tick depends on what is around the view, not
+//  on the length of the level. Box queries use the same order.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "iLevel.h"
+#include "iLevelStream.h"
+#include "iSnapshot.h"
+
+#define MAX_ARCHETYPES 16
+#define MAX_ENTITY_KINDS 32
+
+enum EntityComponent
+{
+    ENTITY_POSITION = 1, // x, y: centre, in pixels
+    ENTITY_BOX = 2,      // width, height
+    ENTITY_VELOCITY = 4, // vx, vy: pixels per tick
+    ENTITY_PATROL = 8    // minX, maxX: turns around at either end (needs ENTITY_VELOCITY)
+};
+
+typedef struct
+{
+    unsigned components; // EntityComponent bits
+    int count, capacity;
+    // One array per component field, nullptr if the archetype does not have it
+    char *glyph;
+    float *x, *y;
+    float *width, *height;
+    float *vx, *vy;
+    float *minX, *maxX;
+    int *tick; // the world tick each entity was last moved at (ENTITY_VELOCITY)
+    unsigned char *data; // the one allocation all arrays live in
+    size_t dataSize;
+
+    // Set by iSortEntities(): rows are in order of minX (patrollers) or x
+    // (entities that do not move), so a range of x is a range of rows
+    bool sorted;
+    float maxSpan;      // widest patrol range, maxX - minX
+    float maxHalfWidth; // half of the widest box
+} EntityArchetype;
+
+typedef struct
+{
+    char glyph;
+    int archetype;
+    float width, height;
+    float speed; // pixels per tick, to the right at first
+    float range; // patrol distance on each side of the spawn, in pixels
+} EntityKind;
+
+typedef struct
+{
+    EntityArchetype archetypes[MAX_ARCHETYPES];
+    int archetypeCount;
+    EntityKind kinds[MAX_ENTITY_KINDS];
+    int kindCount;
+    int tick; // ticks updated so far
+} EntityWorld;
+
+inline bool iHasComponents(const EntityArchetype *archetype, unsigned components)
+{
+    return (archetype->components & components) == components;
+}
+
+// Carves an array of `capacity` elements of `size` bytes out of the archetype's block
+inline void *iEntityArray(unsigned char *data, size_t *offset, int capacity, size_t size)
+{
+    void *array = data ? data + *offset : nullptr;
+    *offset += ((size_t)capacity * size + 15) / 16 * 16;
+    return array;
+}
+
+void iLayOutEntityArchetype(EntityArchetype *archetype, unsigned char *data)
+{
+    size_t offset = 0;
+    int n = archetype->capacity;
+    unsigned c = archetype->components;
+    archetype->glyph = (char *)iEntityArray(data, &offset, n, sizeof(char));
+    archetype->x = (c & ENTITY_POSITION) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->y = (c & ENTITY_POSITION) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->width = (c & ENTITY_BOX) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->height = (c & ENTITY_BOX) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->vx = (c & ENTITY_VELOCITY) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->vy = (c & ENTITY_VELOCITY) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->minX = (c & ENTITY_PATROL) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->maxX = (c & ENTITY_PATROL) ? (float *)iEntityArray(data, &offset, n, sizeof(float)) : nullptr;
+    archetype->tick = (c & ENTITY_VELOCITY) ? (int *)iEntityArray(data, &offset, n, sizeof(int)) : nullptr;
+    archetype->dataSize = offset;
+}
+
+// Adds an archetype that holds up to `capacity` entities. The arrays are
+// allocated once and never move, so they can be registered in a snapshot.
+// Returns its index, or -1 on failure.
+int iAddEntityArchetype(EntityWorld *world, unsigned components, int capacity)
+{
+    if (world->archetypeCount >= MAX_ARCHETYPES)
+    {
+        printf("Error: Maximum number of entity archetypes reached.\n");
+        return -1;
+    }
+    EntityArchetype *archetype = &world->archetypes[world->archetypeCount];
+    memset(archetype, 0, sizeof(EntityArchetype));
+    archetype->components = components | ENTITY_POSITION;
+    archetype->capacity = capacity > 0 ? capacity : 0;
+    iLayOutEntityArchetype(archetype, nullptr);
+    archetype->data = (unsigned char *)malloc(archetype->dataSize > 0 ? archetype->dataSize : 1);
+    if (archetype->data == nullptr)
+    {
+        printf("Failed to allocate %d entities\n", capacity);
+        return -1;
+    }
+    iLayOutEntityArchetype(archetype, archetype->data);
+    return world->archetypeCount++;
+}
+
+// Glyph `glyph` spawns an entity of `archetype` with this box, moving at
+// `speed` and turning `range` pixels either side of where it was placed
+bool iAddEntityKind(EntityWorld *world, char glyph, int archetype, float width, float height, float speed = 0,
+                    float range = 0)
+{
+    if (world->kindCount >= MAX_ENTITY_KINDS || archetype < 0 || archetype >= world->archetypeCount)
+    {
+        printf("Error: Cannot add the entity kind '%c'.\n", glyph);
+        return false;
+    }
+    EntityKind *kind = &world->kinds[world->kindCount++];
+    kind->glyph = glyph;
+    kind->archetype = archetype;
+    kind->width = width;
+    kind->height = height;
+    kind->speed = speed;
+    kind->range = range;
+    return true;
+}
+
+const EntityKind *iFindEntityKind(const EntityWorld *world, char glyph)
+{
+    for (int i = 0; i < world->kindCount; i++)
+    {
+        if (world->kinds[i].glyph == glyph)
+            return &world->kinds[i];
+    }
+    return nullptr;
+}
+
+// Places an entity of `kind` centred on (x, y). Returns its row, or -1 if
+// its archetype is full. The archetype has to be sorted again afterwards.
+int iSpawnEntity(EntityWorld *world, const EntityKind *kind, float x, float y)
+{
+    EntityArchetype *archetype = &world->archetypes[kind->archetype];
+    if (archetype->count >= archetype->capacity)
+    {
+        printf("Error: Maximum number of '%c' entities reached.\n", kind->glyph);
+        return -1;
+    }
+    int i = archetype->count++;
+    archetype->sorted = false;
+    archetype->glyph[i] = kind->glyph;
+    archetype->x[i] = x;
+    archetype->y[i] = y;
+    if (archetype->width)
+    {
+        archetype->width[i] = kind->width;
+        archetype->height[i] = kind->height;
+    }
+    if (archetype->vx)
+    {
+        archetype->vx[i] = kind->speed;
+        archetype->vy[i] = 0;
+        archetype->tick[i] = world->tick;
+    }
+    if (archetype->minX)
+    {
+        archetype->minX[i] = x - kind->range;
+        archetype->maxX[i] = x + kind->range;
+    }
+    return i;
+}
+
+// Removes row `i`. The last entity of the archetype takes its row, or in a
+// sorted archetype the rows after it move up one to keep the order.
+void iRemoveEntity(EntityArchetype *archetype, int i)
+{
+    int last = --archetype->count;
+    float *arrays[] = {archetype->x, archetype->y, archetype->width, archetype->height,
+                       archetype->vx, archetype->vy, archetype->minX, archetype->maxX};
+    if (archetype->sorted)
+    {
+        int moved = last - i;
+        memmove(archetype->glyph + i, archetype->glyph + i + 1, moved);
+        for (float *array : arrays)
+        {
+            if (array)
+                memmove(array + i, array + i + 1, moved * sizeof(float));
+        }
+        if (archetype->tick)
+            memmove(archetype->tick + i, archetype->tick + i + 1, moved * sizeof(int));
+        return;
+    }
+    archetype->glyph[i] = archetype->glyph[last];
+    for (float *array : arrays)
+    {
+        if (array)
+            array[i] = array[last];
+    }
+    if (archetype->tick)
+        archetype->tick[i] = archetype->tick[last];
+}
+
+void iClearEntities(EntityWorld *world)
+{
+    for (int a = 0; a < world->archetypeCount; a++)
+        world->archetypes[a].count = 0;
+}
+
+void iFreeEntityWorld(EntityWorld *world)
+{
+    for (int a = 0; a < world->archetypeCount; a++)
+        free(world->archetypes[a].data);
+    memset(world, 0, sizeof(EntityWorld));
+}
+
+// Spawns an entity on every tile whose glyph has a kind, at the tile centre.
+// Compiled levels are read from their spawn lists. Returns the number spawned.
+int iSpawnLevelEntities(EntityWorld *world, const Level *level, int tileWidth, int tileHeight, int topY)
+{
+    int spawned = 0;
+    for (int k = 0; k < world->kindCount; k++)
+    {
+        const EntityKind *kind = &world->kinds[k];
+        int count;
+        const LevelSpawn *spawns = iFindSpawns(level, kind->glyph, &count);
+        if (level->spawnListCount > 0)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                float x = (spawns[i].col + 0.5f) * tileWidth;
+                float y = topY - (spawns[i].row + 0.5f) * tileHeight;
+                spawned += iSpawnEntity(world, kind, x, y) >= 0;
+            }
+            continue;
+        }
+        for (int row = 0; row < level->rows; row++)
+        {
+            const char *cells = iLevelRow(level, row);
+            for (int col = 0; col < level->cols; col++)
+            {
+                if (cells[col] == kind->glyph)
+                    spawned += iSpawnEntity(world, kind, (col + 0.5f) * tileWidth, topY - (row + 0.5f) * tileHeight) >= 0;
+            }
+        }
+    }
+    return spawned;
+}
+
+// The same for a streamed level, from the tiles the loader listed (see the
+// spawnGlyphs of iOpenLevelStream), so the whole level is spawned at once
+int iSpawnStreamEntities(EntityWorld *world, const LevelStream *stream, int tileWidth, int tileHeight, int topY)
+{
+    const EntityKind *kinds[256] = {nullptr};
+    for (int k = world->kindCount - 1; k >= 0; k--)
+        kinds[(unsigned char)world->kinds[k].glyph] = &world->kinds[k];
+    int spawned = 0;
+    for (int i = 0; i < stream->spawnCount; i++)
+    {
+        const StreamSpawn *spawn = &stream->spawns[i];
+        const EntityKind *kind = kinds[(unsigned char)spawn->glyph];
+        if (kind)
+        {
+            float x = (spawn->col + 0.5f) * tileWidth;
+            float y = topY - (spawn->row + 0.5f) * tileHeight;
+            spawned += iSpawnEntity(world, kind, x, y) >= 0;
+        }
+    }
+    return spawned;
+}
+
+// The x rows are sorted by: a patroller never leaves [minX, maxX], so its
+// order by minX holds while it moves
+inline const float *iEntitySortKey(const EntityArchetype *archetype)
+{
+    return archetype->minX ? archetype->minX : archetype->x;
+}
+
+typedef struct
+{
+    float key;
+    int row;
+} EntityOrder;
+
+int compareEntityOrder(const void *a, const void *b)
+{
+    float ka = ((const EntityOrder *)a)->key, kb = ((const EntityOrder *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// Puts the rows of every archetype in order of position, so updates and
+// queries can go to the rows around a point. Archetypes that move without
+// a patrol cannot stay in order and are left as they are.
+void iSortEntities(EntityWorld *world)
+{
+    for (int a = 0; a < world->archetypeCount; a++)
+    {
+        EntityArchetype *archetype = &world->archetypes[a];
+        if (iHasComponents(archetype, ENTITY_VELOCITY) && !iHasComponents(archetype, ENTITY_PATROL))
+            continue;
+        int n = archetype->count;
+        EntityOrder *order = (EntityOrder *)malloc(sizeof(EntityOrder) * (n > 0 ? n : 1));
+        unsigned char *sorted = (unsigned char *)malloc(archetype->dataSize > 0 ? archetype->dataSize : 1);
+        if (order == nullptr || sorted == nullptr)
+        {
+            printf("Error: Out of memory sorting entities.\n");
+            free(order);
+            free(sorted);
+            continue;
+        }
+        const float *key = iEntitySortKey(archetype);
+        for (int i = 0; i < n; i++)
+            order[i] = {key[i], i};
+        qsort(order, n, sizeof(EntityOrder), compareEntityOrder);
+
+        // Gather every array into a copy of the block in the new order
+        EntityArchetype copy = *archetype;
+        iLayOutEntityArchetype(&copy, sorted);
+        archetype->maxSpan = 0;
+        archetype->maxHalfWidth = 0;
+        for (int k = 0; k < n; k++)
+        {
+            int i = order[k].row;
+            copy.glyph[k] = archetype->glyph[i];
+            copy.x[k] = archetype->x[i];
+            copy.y[k] = archetype->y[i];
+            if (copy.width)
+            {
+                copy.width[k] = archetype->width[i];
+                copy.height[k] = archetype->height[i];
+                archetype->maxHalfWidth = fmaxf(archetype->maxHalfWidth, copy.width[k] / 2);
+            }
+            if (copy.vx)
+            {
+                copy.vx[k] = archetype->vx[i];
+                copy.vy[k] = archetype->vy[i];
+                copy.tick[k] = archetype->tick[i];
+            }
+            if (copy.minX)
+            {
+                copy.minX[k] = archetype->minX[i];
+                copy.maxX[k] = archetype->maxX[i];
+                archetype->maxSpan = fmaxf(archetype->maxSpan, copy.maxX[k] - copy.minX[k]);
+            }
+        }
+        memcpy(archetype->data, sorted, archetype->dataSize);
+        archetype->sorted = true;
+        free(order);
+        free(sorted);
+    }
+}
+
+// First row whose sort key is at least `key`
+int iLowerEntityRow(const EntityArchetype *archetype, float key)
+{
+    const float *keys = iEntitySortKey(archetype);
+    int lo = 0, hi = archetype->count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Rows [first, last) hold every entity that can overlap x0..x1 (all rows if
+// the archetype is not sorted)
+void iFindEntityRange(const EntityArchetype *archetype, float x0, float x1, int *first, int *last)
+{
+    if (!archetype->sorted)
+    {
+        *first = 0;
+        *last = archetype->count;
+        return;
+    }
+    *first = iLowerEntityRow(archetype, x0 - archetype->maxSpan - archetype->maxHalfWidth);
+    *last = iLowerEntityRow(archetype, nextafterf(x1 + archetype->maxHalfWidth, INFINITY));
+    if (*last < *first)
+        *last = *first;
+}
+
+// Moves rows [first, last) to tick `now`, by however many ticks each one is
+// behind. Patrollers move along the triangle wave of their range, which is
+// exact for any number of ticks, so a dormant patroller that wakes up is
+// where it would have been had it moved every tick.
+void iAdvanceEntities(EntityArchetype *archetype, int first, int last, int now)
+{
+    float *x = archetype->x, *y = archetype->y, *vx = archetype->vx;
+    const float *vy = archetype->vy;
+    int *tick = archetype->tick;
+    if (!archetype->minX)
+    {
+        for (int i = first; i < last; i++)
+        {
+            float dt = (float)(now - tick[i]);
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            tick[i] = now;
+        }
+        return;
+    }
+    const float *minX = archetype->minX, *maxX = archetype->maxX;
+    for (int i = first; i < last; i++)
+    {
+        float dt = (float)(now - tick[i]);
+        float span = maxX[i] - minX[i];
+        float period = fmaxf(2 * span, 1e-6f);
+        float offset = x[i] - minX[i];
+        float phase = vx[i] >= 0 ? offset : period - offset; // distance along the loop
+        phase = fmodf(phase + fabsf(vx[i]) * dt, period);
+        bool back = phase > span;
+        x[i] = minX[i] + (back ? period - phase : phase);
+        vx[i] = back ? -fabsf(vx[i]) : fabsf(vx[i]);
+        y[i] += vy[i] * dt;
+        tick[i] = now;
+    }
+}
+
+// One tick of movement for every entity that moves
+void iUpdateEntities(EntityWorld *world)
+{
+    world->tick++;
+    for (int a = 0; a < world->archetypeCount; a++)
+    {
+        EntityArchetype *archetype = &world->archetypes[a];
+        if (iHasComponents(archetype, ENTITY_VELOCITY))
+            iAdvanceEntities(archetype, 0, archetype->count, world->tick);
+    }
+}
+
+// One tick of movement, throttled by distance from the view (viewLeft..viewRight):
+//  - active, within activeMargin pixels of the view: moved every tick
+//  - near, within nearMargin pixels: a 1 / nearInterval slice moved every tick
+//  - dormant, further away: not moved until they come nearer
+// Archetypes that are not sorted are moved every tick. Returns the number of
+// entities moved.
+int iUpdateEntitiesAround(EntityWorld *world, float viewLeft, float viewRight, float activeMargin, float nearMargin,
+                          int nearInterval = 8)
+{
+    world->tick++;
+    if (nearInterval < 1)
+        nearInterval = 1;
+    int moved = 0;
+    for (int a = 0; a < world->archetypeCount; a++)
+    {
+        EntityArchetype *archetype = &world->archetypes[a];
+        if (!iHasComponents(archetype, ENTITY_VELOCITY))
+            continue;
+        if (!archetype->sorted)
+        {
+            iAdvanceEntities(archetype, 0, archetype->count, world->tick);
+            moved += archetype->count;
+            continue;
+        }
+        int active0, active1, near0, near1;
+        iFindEntityRange(archetype, viewLeft - activeMargin, viewRight + activeMargin, &active0, &active1);
+        iFindEntityRange(archetype, viewLeft - nearMargin, viewRight + nearMargin, &near0, &near1);
+        if (near0 > active0)
+            near0 = active0;
+        if (near1 < active1)
+            near1 = active1;
+        iAdvanceEntities(archetype, active0, active1, world->tick);
+        moved += active1 - active0;
+
+        // This tick's slice of the rows on each side of the active ones
+        int slice = world->tick % nearInterval;
+        int sides[2][2] = {{near0, active0}, {active1, near1}};
+        for (int s = 0; s < 2; s++)
+        {
+            int n = sides[s][1] - sides[s][0];
+            int first = sides[s][0] + n * slice / nearInterval;
+            int last = sides[s][0] + n * (slice + 1) / nearInterval;
+            iAdvanceEntities(archetype, first, last, world->tick);
+            moved += last - first;
+        }
+    }
+    return moved;
+}
+
+// Number of entities of the archetype whose box overlaps the box of this size centred on (x, y)
+int iCountEntitiesInBox(const EntityArchetype *archetype, float x, float y, float width, float height)
+{
+    if (!iHasComponents(archetype, ENTITY_BOX))
+        return 0;
+    int first, last;
+    iFindEntityRange(archetype, x - width / 2, x + width / 2, &first, &last);
+    const float *ex = archetype->x, *ey = archetype->y;
+    const float *ew = archetype->width, *eh = archetype->height;
+    int hits = 0;
+    for (int i = first; i < last; i++)
+        hits += (fabsf(ex[i] - x) * 2 < ew[i] + width) & (fabsf(ey[i] - y) * 2 < eh[i] + height);
+    return hits;
+}
+
+// Rows of the entities overlapping the box, up to maxRows. Returns the number found.
+int iFindEntitiesInBox(const EntityArchetype *archetype, float x, float y, float width, float height, int *rows,
+                       int maxRows)
+{
+    if (!iHasComponents(archetype, ENTITY_BOX))
+        return 0;
+    int first, last;
+    iFindEntityRange(archetype, x - width / 2, x + width / 2, &first, &last);
+    int found = 0;
+    for (int i = first; i < last && found < maxRows; i++)
+    {
+        if (fabsf(archetype->x[i] - x) * 2 < archetype->width[i] + width &&
+            fabsf(archetype->y[i] - y) * 2 < archetype->height[i] + height)
+            rows[found++] = i;
+    }
+    return found;
+}
+
+// Adds every archetype's entities to a snapshot (see iSnapshot.h)
+bool iAddEntitiesToSnapshot(Snapshot *snapshot, EntityWorld *world)
+{
+    if (!iAddSnapshotVariable(snapshot, world->tick))
+        return false;
+    for (int a = 0; a < world->archetypeCount; a++)
+    {
+        EntityArchetype *archetype = &world->archetypes[a];
+        if (!iAddSnapshotVariable(snapshot, archetype->count) ||
+            !iAddSnapshotRegion(snapshot, archetype->data, archetype->dataSize))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,331 @@
+//
+//  Flow fields: the way to one tile (the player's) from every tile around
+//  it, so any number of enemies can chase the player by looking up the tile
+//  they are in, instead of each one searching for a path.
+//
+//  A field is a breadth-first search from the target over the empty tiles
+//  within `range` columns of it, to any of the 8 neighbours without cutting
+//  the corner of a solid tile. It is searched again only when the target
+//  moves to another tile, on a worker thread and into a second buffer: the
+//  game keeps sampling the last finished field until iUpdateFlowField()
+//  swaps the new one in, so a search never holds up a tick.
+//
+//      FlowField chase;
+//      iInitFlowField(&chase, level.rows, 20);
+//      ...
+//      iUpdateFlowField(&chase, &tiles, ballX, ballY); // every tick
+//      float dx, dy;
+//      if (iSampleFlow(&chase, enemyX, enemyY, &dx, &dy)) ...
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "iTiles.h"
+
+#define MAX_FLOW_JOBS 16 // fields being searched at once
+#define FLOW_NONE 8      // direction of the target tile and of tiles with no way to it
+
+enum FlowFieldState
+{
+    FLOW_IDLE,   // nothing to do, or the last search has been swapped in
+    FLOW_QUEUED, // the worker is searching into the back buffer
+    FLOW_DONE    // the back buffer holds a new field
+};
+
+typedef struct
+{
+    int *steps;               // moves to the target, -1 if there is no way
+    unsigned char *direction; // neighbour to move to next (see iFlowRowStep), FLOW_NONE if none
+    int rows, cols;
+    int firstCol;             // level column of column 0
+    int targetRow, targetCol; // -1 before the first search
+    int tileWidth, tileHeight;
+    int topY;
+} FlowFieldBuffer;
+
+typedef struct
+{
+    FlowFieldBuffer buffers[2]; // buffers[front] is sampled, the other one is searched into
+    int front;
+    int maxRows, range;
+    int capacity;             // tiles per buffer
+    unsigned char *solid;     // the tiles around the target, copied for the worker
+    int *queue;               // the worker's search queue
+    int state;                // FlowFieldState, changed by the worker
+    int queuedRow, queuedCol; // target of the last search queued
+    bool dirty;               // search again even if the target stays in its tile
+} FlowField;
+
+// Row and column offsets of the 8 neighbours; straight moves come first, so
+// paths prefer them
+const int iFlowRowStep[8] = {-1, 1, 0, 0, -1, -1, 1, 1};
+const int iFlowColStep[8] = {0, 0, -1, 1, -1, 1, -1, 1};
+const unsigned char iFlowOpposite[8] = {1, 0, 3, 2, 7, 6, 5, 4};
+
+FlowField *iFlowJobs[MAX_FLOW_JOBS];
+int iFlowJobHead = 0, iFlowJobCount = 0;
+bool iFlowThreadStarted = false;
+// Never destroyed: the detached worker may still be waiting on them at exit()
+std::mutex &iFlowMutex = *new std::mutex();
+std::condition_variable &iFlowWork = *new std::condition_variable(); // a search was queued
+std::condition_variable &iFlowDone = *new std::condition_variable(); // a search finished
+
+// Allocates a field of up to `maxRows` rows that covers `range` columns on
+// each side of the target
+bool iInitFlowField(FlowField *field, int maxRows, int range)
+{
+    memset(field, 0, sizeof(FlowField));
+    field->maxRows = maxRows > 0 ? maxRows : 1;
+    field->range = range > 0 ? range : 0;
+    field->capacity = field->maxRows * (2 * field->range + 1);
+    field->solid = (unsigned char *)malloc(field->capacity);
+    field->queue = (int *)malloc(sizeof(int) * field->capacity);
+    bool allocated = field->solid && field->queue;
+    for (int b = 0; b < 2; b++)
+    {
+        FlowFieldBuffer *buffer = &field->buffers[b];
+        buffer->steps = (int *)malloc(sizeof(int) * field->capacity);
+        buffer->direction = (unsigned char *)malloc(field->capacity);
+        buffer->targetRow = buffer->targetCol = -1;
+        allocated = allocated && buffer->steps && buffer->direction;
+    }
+    field->queuedRow = field->queuedCol = -1;
+    if (!allocated)
+    {
+        printf("Failed to allocate a flow field of %d tiles\n", field->capacity);
+        return false;
+    }
+    return true;
+}
+
+// Breadth-first search from the target of `out` over the tiles of `solid`
+// (out->rows x out->cols, nonzero where blocked)
+void iSearchFlowField(FlowFieldBuffer *out, const unsigned char *solid, int *queue)
+{
+    int rows = out->rows, cols = out->cols;
+    for (int i = 0; i < rows * cols; i++)
+    {
+        out->steps[i] = -1;
+        out->direction[i] = FLOW_NONE;
+    }
+    int target = out->targetRow * cols + (out->targetCol - out->firstCol);
+    out->steps[target] = 0;
+    queue[0] = target;
+    int head = 0, tail = 1;
+    while (head < tail)
+    {
+        int cell = queue[head++];
+        int row = cell / cols, col = cell % cols;
+        for (int d = 0; d < 8; d++)
+        {
+            int nextRow = row + iFlowRowStep[d], nextCol = col + iFlowColStep[d];
+            if (nextRow < 0 || nextRow >= rows || nextCol < 0 || nextCol >= cols)
+                continue;
+            int next = nextRow * cols + nextCol;
+            if (solid[next] || out->steps[next] >= 0)
+                continue;
+            // A diagonal move needs both tiles beside it free
+            if (d >= 4 && (solid[row * cols + nextCol] || solid[nextRow * cols + col]))
+                continue;
+            out->steps[next] = out->steps[cell] + 1;
+            out->direction[next] = iFlowOpposite[d]; // back the way the search came
+            queue[tail++] = next;
+        }
+    }
+}
+
+void iFlowWorker()
+{
+    while (true)
+    {
+        FlowField *field;
+        FlowFieldBuffer *back;
+        {
+            std::unique_lock<std::mutex> lock(iFlowMutex);
+            iFlowWork.wait(lock, []
+                           { return iFlowJobCount > 0; });
+            field = iFlowJobs[iFlowJobHead];
+            iFlowJobHead = (iFlowJobHead + 1) % MAX_FLOW_JOBS;
+            iFlowJobCount--;
+            back = &field->buffers[field->front ^ 1];
+        }
+
+        iSearchFlowField(back, field->solid, field->queue);
+
+        std::lock_guard<std::mutex> lock(iFlowMutex);
+        field->state = FLOW_DONE;
+        iFlowDone.notify_all();
+    }
+}
+
+// Swaps in the last finished search, and queues a new one if the target at
+// (x, y) has moved to another tile of `grid` (or iInvalidateFlowField() was
+// called). Call it every tick from the game's thread; it only copies the
+// tiles around the target, the search itself runs on the worker.
+// Returns true if a new field was swapped in.
+bool iUpdateFlowField(FlowField *field, const TileGrid *grid, float x, float y, char solid = '#')
+{
+    bool swapped = false;
+    {
+        std::lock_guard<std::mutex> lock(iFlowMutex);
+        if (field->state == FLOW_DONE)
+        {
+            field->front ^= 1;
+            field->state = FLOW_IDLE;
+            swapped = true;
+        }
+        if (field->state != FLOW_IDLE)
+            return swapped;
+    }
+
+    int rows = grid->rows < field->maxRows ? grid->rows : field->maxRows;
+    int col = (int)floorf(x / grid->tileWidth);
+    int row = (int)floorf((grid->topY - y) / grid->tileHeight);
+    if (row < 0)
+        row = 0;
+    if (row >= rows)
+        row = rows - 1;
+    if (rows <= 0 || col < grid->firstCol || col >= grid->firstCol + grid->cols)
+        return swapped;
+    if (!field->dirty && row == field->queuedRow && col == field->queuedCol)
+        return swapped;
+
+    // The worker searches a copy, as the grid may change while it runs
+    FlowFieldBuffer *back = &field->buffers[field->front ^ 1];
+    int firstCol = col - field->range, lastCol = col + field->range;
+    if (firstCol < grid->firstCol)
+        firstCol = grid->firstCol;
+    if (lastCol > grid->firstCol + grid->cols - 1)
+        lastCol = grid->firstCol + grid->cols - 1;
+    back->rows = rows;
+    back->cols = lastCol - firstCol + 1;
+    back->firstCol = firstCol;
+    back->targetRow = row;
+    back->targetCol = col;
+    back->tileWidth = grid->tileWidth;
+    back->tileHeight = grid->tileHeight;
+    back->topY = grid->topY;
+    unsigned char *blocked = field->solid;
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = firstCol; c <= lastCol; c++)
+        {
+            char glyph = iGetTile(grid, r, c);
+            *blocked++ = glyph == solid || glyph == '\0';
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(iFlowMutex);
+    if (iFlowJobCount >= MAX_FLOW_JOBS)
+        return swapped;
+    if (!iFlowThreadStarted)
+    {
+        // The worker lives as long as the program; GLUT exits without returning
+        std::thread(iFlowWorker).detach();
+        iFlowThreadStarted = true;
+    }
+    iFlowJobs[(iFlowJobHead + iFlowJobCount) % MAX_FLOW_JOBS] = field;
+    iFlowJobCount++;
+    field->state = FLOW_QUEUED;
+    field->queuedRow = row;
+    field->queuedCol = col;
+    field->dirty = false;
+    iFlowWork.notify_one();
+    return swapped;
+}
+
+// Searches again on the next update, e.g. after a solid tile was added or removed
+void iInvalidateFlowField(FlowField *field)
+{
+    field->dirty = true;
+}
+
+// Index of the tile at (x, y) in the sampled field, or -1 outside it
+inline int iFlowFieldCell(const FlowFieldBuffer *buffer, float x, float y)
+{
+    if (buffer->targetRow < 0)
+        return -1;
+    int col = (int)floorf(x / buffer->tileWidth) - buffer->firstCol;
+    int row = (int)floorf((buffer->topY - y) / buffer->tileHeight);
+    if (row < 0 || row >= buffer->rows || col < 0 || col >= buffer->cols)
+        return -1;
+    return row * buffer->cols + col;
+}
+
+// Moves from (x, y) to the target, or -1 if there is no way or it is outside the field
+int iFlowSteps(const FlowField *field, float x, float y)
+{
+    const FlowFieldBuffer *buffer = &field->buffers[field->front];
+    int cell = iFlowFieldCell(buffer, x, y);
+    return cell < 0 ? -1 : buffer->steps[cell];
+}
+
+// Unit vector from (x, y) to the centre of the next tile on the way to the
+// target (of the target tile once there). Returns false, with (0, 0), if
+// there is no way or (x, y) is outside the field.
+bool iSampleFlow(const FlowField *field, float x, float y, float *dx, float *dy)
+{
+    *dx = 0;
+    *dy = 0;
+    const FlowFieldBuffer *buffer = &field->buffers[field->front];
+    int cell = iFlowFieldCell(buffer, x, y);
+    if (cell < 0 || buffer->steps[cell] < 0)
+        return false;
+    int row = cell / buffer->cols, col = cell % buffer->cols + buffer->firstCol;
+    int d = buffer->direction[cell];
+    if (d != FLOW_NONE)
+    {
+        row += iFlowRowStep[d];
+        col += iFlowColStep[d];
+    }
+    float toX = (col + 0.5f) * buffer->tileWidth - x;
+    float toY = buffer->topY - (row + 0.5f) * buffer->tileHeight - y;
+    float length = sqrtf(toX * toX + toY * toY);
+    if (length > 1e-3f)
+    {
+        *dx = toX / length;
+        *dy = toY / length;
+    }
+    return true;
+}
+
+// Sets the velocity of `count` objects (e.g. the rows of an entity archetype)
+// to `speed` pixels per tick along the field; those with no way stop.
+// Returns the number that have a way to the target.
+int iFollowFlowField(const FlowField *field, const float *x, const float *y, float *vx, float *vy, int count,
+                     float speed)
+{
+    int following = 0;
+    for (int i = 0; i < count; i++)
+    {
+        following += iSampleFlow(field, x[i], y[i], &vx[i], &vy[i]);
+        vx[i] *= speed;
+        vy[i] *= speed;
+    }
+    return following;
+}
+
+// Waits for a search still running, then frees the buffers
+void iFreeFlowField(FlowField *field)
+{
+    {
+        std::unique_lock<std::mutex> lock(iFlowMutex);
+        iFlowDone.wait(lock, [field]
+                       { return field->state != FLOW_QUEUED; });
+    }
+    free(field->solid);
+    free(field->queue);
+    for (int b = 0; b < 2; b++)
+    {
+        free(field->buffers[b].steps);
+        free(field->buffers[b].direction);
+    }
+    memset(field, 0, sizeof(FlowField));
+}
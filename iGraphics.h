@@ -20,9 +20,43 @@
 #include "freeglut_ext.h"
 #include <time.h>
 #include <math.h>
+#include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 // #include "glaux.h"
+#include "iPack.h"
+
+//
+// Long-lived pixel buffers (Image::data, collision masks) all come from this
+// allocator, and stb_image is routed through it too. So iFreeImage() can
+// release any Image no matter whether it was decoded, copied or resized.
+//
+void *iAllocPixels(size_t size)
+{
+    return malloc(size);
+}
+
+void *iReallocPixels(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void iFreePixels(void *ptr)
+{
+    free(ptr);
+}
+
+#define STBI_MALLOC(size) iAllocPixels(size)
+#define STBI_REALLOC(ptr, size) iReallocPixels(ptr, size)
+#define STBI_FREE(ptr) iFreePixels(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
@@ -38,20 +72,42 @@ typedef struct
 {
     unsigned char *data;
     int width, height, channels;
+    bool packed; // data points into a mapped asset pack: read-only and never freed
 } Image;
 
+// One bit per pixel (1 = solid). Each row is `words` 64-bit words, pixel x of
+// a row is bit (x % 64) of word (x / 64). Rows carry one extra zero word so
+// unaligned 64-bit windows can always read the next word.
 typedef struct
 {
+    uint64_t *bits;
+    int *spans; // first and last solid x of each row (first > last if the row is empty)
+    int width, height;
+    int words;    // words per row
+    int capacity; // words allocated (bits and spans share one block)
+    int minX, minY, maxX, maxY; // tight box around the solid pixels (minX > maxX if none)
+} CollisionMask;
+
+typedef struct CollisionWorld CollisionWorld;
+
+typedef struct
+{
+    int id; // unique per sprite, assigned by iInitSprite
     int x, y;
     Image *frames; // Array of individual frame images
     int currentFrame;
     int totalFrames;
-    unsigned char *collisionMask;
+    CollisionMask *collisionMasks; // one per frame, built when the frames change
+    int collisionMaskCount;
+    unsigned int generation; // bumped whenever the frame images change
     int ignoreColor;
 
     // Tracking transformation
     float scale;
     bool flipHorizontal, flipVertical;
+
+    CollisionWorld *world; // set while the sprite is in a collision world
+    int worldIndex;
 } Sprite;
 
 enum MirrorState
@@ -145,13 +201,99 @@ void iResumeTimer(int index)
     }
 }
 
+//
+// Frame arena: a bump-pointer allocator for temporaries that only live until
+// the end of the current frame. It is reset right after glutSwapBuffers().
+// Requests that do not fit go to a spill block; on the next reset the arena
+// grows to cover them, so after the first few frames nothing on the draw path
+// touches the heap.
+//
+#define FRAME_ARENA_ALIGN 16
+#define FRAME_ARENA_MAX_SPILLS 64
+
+typedef struct
+{
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+    size_t spilled; // bytes that did not fit this frame
+    void *spills[FRAME_ARENA_MAX_SPILLS];
+    int spillCount;
+} FrameArena;
+
+FrameArena iFrameArena = {nullptr, 0, 0, 0, {nullptr}, 0};
+
+void *iFrameAlloc(size_t size)
+{
+    size = (size + FRAME_ARENA_ALIGN - 1) & ~(size_t)(FRAME_ARENA_ALIGN - 1);
+    if (iFrameArena.used + size <= iFrameArena.capacity)
+    {
+        void *ptr = iFrameArena.base + iFrameArena.used;
+        iFrameArena.used += size;
+        return ptr;
+    }
+
+    if (iFrameArena.spillCount >= FRAME_ARENA_MAX_SPILLS)
+    {
+        printf("Error: Frame arena spill limit reached.\n");
+        return nullptr;
+    }
+    void *ptr = malloc(size);
+    if (ptr == nullptr)
+        return nullptr;
+    iFrameArena.spills[iFrameArena.spillCount++] = ptr;
+    iFrameArena.spilled += size;
+    return ptr;
+}
+
+void iResetFrameArena()
+{
+    if (iFrameArena.spillCount > 0)
+    {
+        for (int i = 0; i < iFrameArena.spillCount; i++)
+        {
+            free(iFrameArena.spills[i]);
+        }
+        iFrameArena.spillCount = 0;
+
+        // Grow once to the high-water mark (plus headroom) so the next frame fits
+        size_t capacity = (iFrameArena.capacity + iFrameArena.spilled) * 3 / 2;
+        unsigned char *base = (unsigned char *)malloc(capacity);
+        if (base != nullptr)
+        {
+            free(iFrameArena.base);
+            iFrameArena.base = base;
+            iFrameArena.capacity = capacity;
+        }
+        iFrameArena.spilled = 0;
+    }
+    iFrameArena.used = 0;
+}
+
 // Additional functions for displaying images
 
+// Takes the image from an open asset pack if it is there, otherwise decodes the file
+bool iLoadImageData(const char *filename, Image *img)
+{
+    const PackEntry *entry = iFindPackEntry(filename, PACK_IMAGE);
+    if (entry != nullptr)
+    {
+        img->data = (unsigned char *)iPackData(entry);
+        img->width = entry->params[0];
+        img->height = entry->params[1];
+        img->channels = entry->params[2];
+        img->packed = true;
+        return true;
+    }
+    img->packed = false;
+    img->data = stbi_load(filename, &img->width, &img->height, &img->channels, 0);
+    return img->data != nullptr;
+}
+
 bool iLoadImage(Image *img, const char filename[])
 {
     stbi_set_flip_vertically_on_load(true);
-    img->data = stbi_load(filename, &img->width, &img->height, &img->channels, 0);
-    if (img->data == nullptr)
+    if (!iLoadImageData(filename, img))
     {
         printf("Failed to load image: %s\n", stbi_failure_reason());
         return false;
@@ -159,9 +301,261 @@ bool iLoadImage(Image *img, const char filename[])
     return true;
 }
 
+// Pack images are read-only; give the image its own copy before changing pixels in place
+bool iMakeImageWritable(Image *img)
+{
+    if (!img->packed)
+        return true;
+    size_t size = (size_t)img->width * img->height * img->channels;
+    unsigned char *copy = (unsigned char *)iAllocPixels(size);
+    if (copy == nullptr)
+        return false;
+    memcpy(copy, img->data, size);
+    img->data = copy;
+    img->packed = false;
+    return true;
+}
+
+//
+// Resize cache: iGetResizedImage() and iGetScaledImage() leave the source
+// untouched and remember their results, keyed by the source pixels and the
+// target size. Least recently used results are dropped once the cache holds
+// more than its byte budget. With iBuildMipChain() a resize starts from the
+// smallest pre-halved copy that is still big enough, which is cheaper and
+// avoids aliasing on strong down-scaling.
+//
+#define MAX_RESIZED_IMAGES 256
+#define RESIZE_CACHE_BUCKETS 64
+#define RESIZE_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+typedef struct
+{
+    const unsigned char *source; // pixels of the original image (the key)
+    int sourceWidth, sourceHeight;
+    Image img;
+    unsigned int lastUsed;
+    int next; // next entry in the same bucket, or in the free list
+    bool used;
+} ResizedImage;
+
+ResizedImage iResizedImages[MAX_RESIZED_IMAGES];
+int iResizeCacheBuckets[RESIZE_CACHE_BUCKETS];
+int iResizeCacheFree = -1;
+bool iResizeCacheReady = false;
+size_t iResizeCacheBytes = 0;
+size_t iResizeCacheBudget = RESIZE_CACHE_DEFAULT_BUDGET;
+unsigned int iResizeCacheClock = 0;
+
+int iResizeCacheBucket(const unsigned char *source, int width, int height)
+{
+    size_t h = (size_t)source;
+    h ^= h >> 17;
+    h += (size_t)width * 73856093u + (size_t)height * 19349663u;
+    return (int)(h % RESIZE_CACHE_BUCKETS);
+}
+
+void iInitResizeCache()
+{
+    for (int i = 0; i < RESIZE_CACHE_BUCKETS; i++)
+        iResizeCacheBuckets[i] = -1;
+    for (int i = 0; i < MAX_RESIZED_IMAGES; i++)
+    {
+        iResizedImages[i].used = false;
+        iResizedImages[i].next = i + 1 < MAX_RESIZED_IMAGES ? i + 1 : -1;
+    }
+    iResizeCacheFree = 0;
+    iResizeCacheReady = true;
+}
+
+ResizedImage *iFindResizedImage(const Image *src, int width, int height)
+{
+    if (!iResizeCacheReady)
+        return nullptr;
+    int i = iResizeCacheBuckets[iResizeCacheBucket(src->data, width, height)];
+    for (; i != -1; i = iResizedImages[i].next)
+    {
+        ResizedImage *e = &iResizedImages[i];
+        if (e->source == src->data && e->sourceWidth == src->width && e->sourceHeight == src->height &&
+            e->img.width == width && e->img.height == height && e->img.channels == src->channels)
+        {
+            e->lastUsed = ++iResizeCacheClock;
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+void iRemoveResizedImage(int index)
+{
+    ResizedImage *e = &iResizedImages[index];
+    int *link = &iResizeCacheBuckets[iResizeCacheBucket(e->source, e->img.width, e->img.height)];
+    while (*link != index)
+        link = &iResizedImages[*link].next;
+    *link = e->next;
+
+    iResizeCacheBytes -= (size_t)e->img.width * e->img.height * e->img.channels;
+    iFreePixels(e->img.data);
+    e->used = false;
+    e->next = iResizeCacheFree;
+    iResizeCacheFree = index;
+}
+
+// Takes ownership of `img` (pixels from iAllocPixels)
+ResizedImage *iAddResizedImage(const Image *src, Image img)
+{
+    if (!iResizeCacheReady)
+        iInitResizeCache();
+
+    size_t bytes = (size_t)img.width * img.height * img.channels;
+    while (iResizeCacheFree == -1 || (iResizeCacheBytes + bytes > iResizeCacheBudget && iResizeCacheBytes > 0))
+    {
+        int oldest = -1;
+        for (int i = 0; i < MAX_RESIZED_IMAGES; i++)
+        {
+            if (iResizedImages[i].used && (oldest == -1 || iResizedImages[i].lastUsed < iResizedImages[oldest].lastUsed))
+                oldest = i;
+        }
+        iRemoveResizedImage(oldest);
+    }
+
+    int index = iResizeCacheFree;
+    ResizedImage *e = &iResizedImages[index];
+    iResizeCacheFree = e->next;
+    e->source = src->data;
+    e->sourceWidth = src->width;
+    e->sourceHeight = src->height;
+    e->img = img;
+    e->lastUsed = ++iResizeCacheClock;
+    e->used = true;
+
+    int bucket = iResizeCacheBucket(src->data, img.width, img.height);
+    e->next = iResizeCacheBuckets[bucket];
+    iResizeCacheBuckets[bucket] = index;
+    iResizeCacheBytes += bytes;
+    return e;
+}
+
+// Drops every cached resize of `img`. Called whenever its pixels change or are freed.
+void iInvalidateResizedImages(const Image *img)
+{
+    if (!iResizeCacheReady || img->data == nullptr)
+        return;
+    for (int i = 0; i < MAX_RESIZED_IMAGES; i++)
+    {
+        if (iResizedImages[i].used && iResizedImages[i].source == img->data)
+            iRemoveResizedImage(i);
+    }
+}
+
+void iSetResizeCacheBudget(size_t bytes)
+{
+    iResizeCacheBudget = bytes;
+    if (!iResizeCacheReady)
+        return;
+    while (iResizeCacheBytes > iResizeCacheBudget)
+    {
+        int oldest = -1;
+        for (int i = 0; i < MAX_RESIZED_IMAGES; i++)
+        {
+            if (iResizedImages[i].used && (oldest == -1 || iResizedImages[i].lastUsed < iResizedImages[oldest].lastUsed))
+                oldest = i;
+        }
+        iRemoveResizedImage(oldest);
+    }
+}
+
+// Pre-computes half-size copies of `src` (2x2 box filter) down to 1x1
+void iBuildMipChain(const Image *src)
+{
+    Image level = *src;
+    while (level.width > 1 || level.height > 1)
+    {
+        int w = level.width > 1 ? level.width / 2 : 1;
+        int h = level.height > 1 ? level.height / 2 : 1;
+        ResizedImage *cached = iFindResizedImage(src, w, h);
+        if (cached == nullptr)
+        {
+            int c = src->channels;
+            Image half;
+            half.width = w;
+            half.height = h;
+            half.channels = c;
+            half.packed = false;
+            half.data = (unsigned char *)iAllocPixels((size_t)w * h * c);
+            if (half.data == nullptr)
+                return;
+            for (int y = 0; y < h; y++)
+            {
+                const unsigned char *row0 = level.data + (size_t)(2 * y < level.height ? 2 * y : level.height - 1) * level.width * c;
+                const unsigned char *row1 = level.data + (size_t)(2 * y + 1 < level.height ? 2 * y + 1 : level.height - 1) * level.width * c;
+                for (int x = 0; x < w; x++)
+                {
+                    int x0 = (2 * x < level.width ? 2 * x : level.width - 1) * c;
+                    int x1 = (2 * x + 1 < level.width ? 2 * x + 1 : level.width - 1) * c;
+                    for (int k = 0; k < c; k++)
+                    {
+                        half.data[(y * w + x) * c + k] = (row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k] + 2) / 4;
+                    }
+                }
+            }
+            cached = iAddResizedImage(src, half);
+        }
+        level = cached->img;
+    }
+}
+
+// Returns `src` resampled to width x height. The source is not modified.
+// The result belongs to the cache: draw it right away and do not free it.
+Image *iGetResizedImage(const Image *src, int width, int height)
+{
+    if (!src || !src->data || width <= 0 || height <= 0)
+        return nullptr;
+    if (width == src->width && height == src->height)
+        return (Image *)src;
+
+    ResizedImage *cached = iFindResizedImage(src, width, height);
+    if (cached != nullptr)
+        return &cached->img;
+
+    // Start from the smallest mip level (if any) that is still at least as big as the target
+    const Image *from = src;
+    int w = src->width, h = src->height;
+    while (w / 2 >= width && h / 2 >= height)
+    {
+        w /= 2;
+        h /= 2;
+        ResizedImage *mip = iFindResizedImage(src, w, h);
+        if (mip == nullptr)
+            break;
+        from = &mip->img;
+    }
+
+    Image img;
+    img.width = width;
+    img.height = height;
+    img.channels = src->channels;
+    img.packed = false;
+    img.data = (unsigned char *)iAllocPixels((size_t)width * height * src->channels);
+    if (img.data == nullptr)
+        return nullptr;
+    stbir_resize_uint8(from->data, from->width, from->height, 0, img.data, width, height, 0, src->channels);
+    return &iAddResizedImage(src, img)->img;
+}
+
+Image *iGetScaledImage(const Image *src, double scale)
+{
+    if (!src || scale <= 0.0)
+        return nullptr;
+    return iGetResizedImage(src, (int)(src->width * scale), (int)(src->height * scale));
+}
+
 void iFreeImage(Image *img)
 {
-    stbi_image_free(img->data);
+    iInvalidateResizedImages(img);
+    if (!img->packed)
+        iFreePixels(img->data);
+    img->data = nullptr;
+    img->packed = false;
 }
 
 void iShowImage2(int x, int y, Image *img, int ignoreColor)
@@ -215,8 +609,31 @@ void iShowImage2(int x, int y, Image *img, int ignoreColor)
     if (drawWidth <= 0 || drawHeight <= 0)
         return;
 
+    GLenum format = (channels == 4) ? GL_RGBA : GL_RGB;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glRasterPos2i(drawX, drawY);
+
+    // Nothing to mask out: let GL read the visible window straight from the image
+    if (ignoreColor == -1)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, imgWidth);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, startX);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, startY);
+        glDrawPixels(drawWidth, drawHeight, format, GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        return;
+    }
+
     // Create a buffer for the clipped image
-    unsigned char *clippedData = new unsigned char[drawWidth * drawHeight * channels];
+    unsigned char *clippedData = (unsigned char *)iFrameAlloc(drawWidth * drawHeight * channels);
+    if (clippedData == nullptr)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        return;
+    }
 
     for (int y = 0; y < drawHeight; y++)
     {
@@ -231,8 +648,7 @@ void iShowImage2(int x, int y, Image *img, int ignoreColor)
             unsigned char r = data[srcIndex];
             unsigned char g = data[srcIndex + 1];
             unsigned char b = data[srcIndex + 2];
-            bool ignore = (ignoreColor != -1 &&
-                           r == (ignoreColor >> 16 & 0xFF) &&
+            bool ignore = (r == (ignoreColor >> 16 & 0xFF) &&
                            g == ((ignoreColor >> 8) & 0xFF) &&
                            b == ((ignoreColor) & 0xFF));
 
@@ -254,10 +670,8 @@ void iShowImage2(int x, int y, Image *img, int ignoreColor)
         }
     }
 
-    glRasterPos2i(drawX, drawY);
-    glDrawPixels(drawWidth, drawHeight, (channels == 4) ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, clippedData);
-
-    delete[] clippedData;
+    glDrawPixels(drawWidth, drawHeight, format, GL_UNSIGNED_BYTE, clippedData);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 void iShowLoadedImage(int x, int y, Image *img)
@@ -265,16 +679,274 @@ void iShowLoadedImage(int x, int y, Image *img)
     iShowImage2(x, y, img, -1 /* ignoreColor */);
 }
 
-void iShowImage(int x, int y, const char *filename)
+// iShowImage() is usually called with the same few files every frame, so the
+// decoded images are kept around instead of being decoded and freed each time.
+#define MAX_CACHED_IMAGES 32
+#define MAX_CACHED_IMAGE_PATH 256
+
+typedef struct
+{
+    char filename[MAX_CACHED_IMAGE_PATH];
+    Image img;
+} CachedImage;
+
+CachedImage iImageCache[MAX_CACHED_IMAGES];
+int iImageCacheCount = 0;
+int iImageCacheNext = 0; // slot to recycle once the cache is full
+
+Image *iGetCachedImage(const char *filename)
 {
+    for (int i = 0; i < iImageCacheCount; i++)
+    {
+        if (strcmp(iImageCache[i].filename, filename) == 0)
+            return &iImageCache[i].img;
+    }
+
     Image img;
     if (!iLoadImage(&img, filename))
+        return nullptr;
+
+    int slot;
+    if (iImageCacheCount < MAX_CACHED_IMAGES)
+    {
+        slot = iImageCacheCount++;
+    }
+    else
+    {
+        slot = iImageCacheNext;
+        iImageCacheNext = (iImageCacheNext + 1) % MAX_CACHED_IMAGES;
+        iFreeImage(&iImageCache[slot].img);
+    }
+    snprintf(iImageCache[slot].filename, MAX_CACHED_IMAGE_PATH, "%s", filename);
+    iImageCache[slot].img = img;
+    return &iImageCache[slot].img;
+}
+
+void iShowImage(int x, int y, const char *filename)
+{
+    Image *img = iGetCachedImage(filename);
+    if (img == nullptr)
     {
         printf("Failed to load image: %s\n", filename);
         return;
     }
-    iShowImage2(x, y, &img, -1 /* ignoreColor */);
-    iFreeImage(&img);
+    iShowImage2(x, y, img, -1 /* ignoreColor */);
+}
+
+//
+// Asynchronous image loading.
+// iLoadImageAsync() returns a handle right away and a pool of worker threads
+// decodes the file. Finished images are handed over to the GLUT thread at the
+// start of the next frame (iPumpAsyncImages), so an image never becomes
+// visible in the middle of an iDraw() call.
+//
+#define MAX_ASYNC_IMAGES 256
+#define MAX_DECODE_THREADS 8
+
+enum AsyncImageState
+{
+    ASYNC_IMAGE_FREE,
+    ASYNC_IMAGE_QUEUED,
+    ASYNC_IMAGE_DECODED, // decoded by a worker, not yet handed to the render thread
+    ASYNC_IMAGE_READY,
+    ASYNC_IMAGE_FAILED
+};
+
+typedef struct
+{
+    char filename[MAX_CACHED_IMAGE_PATH];
+    Image img;
+    int state;
+    bool cancelled; // freed by the user while a worker still owns it
+} AsyncImage;
+
+AsyncImage iAsyncImages[MAX_ASYNC_IMAGES];
+int iDecodeQueue[MAX_ASYNC_IMAGES];
+int iDecodeQueueHead = 0, iDecodeQueueCount = 0;
+int iDecodeThreadCount = 0;
+// Never destroyed: detached workers may still be waiting on them at exit()
+std::mutex &iDecodeMutex = *new std::mutex();
+std::condition_variable &iDecodeWork = *new std::condition_variable(); // a job was queued
+std::condition_variable &iDecodeDone = *new std::condition_variable(); // a job finished
+
+void iDecodeWorker()
+{
+    while (true)
+    {
+        int handle;
+        {
+            std::unique_lock<std::mutex> lock(iDecodeMutex);
+            iDecodeWork.wait(lock, []
+                             { return iDecodeQueueCount > 0; });
+            handle = iDecodeQueue[iDecodeQueueHead];
+            iDecodeQueueHead = (iDecodeQueueHead + 1) % MAX_ASYNC_IMAGES;
+            iDecodeQueueCount--;
+        }
+
+        AsyncImage *job = &iAsyncImages[handle];
+        Image img;
+        if (!iLoadImageData(job->filename, &img))
+            img.data = nullptr;
+
+        std::lock_guard<std::mutex> lock(iDecodeMutex);
+        if (job->cancelled)
+        {
+            if (!img.packed)
+                iFreePixels(img.data);
+            job->state = ASYNC_IMAGE_FREE;
+        }
+        else if (img.data == nullptr)
+        {
+            printf("Failed to load image: %s\n", job->filename);
+            job->state = ASYNC_IMAGE_FAILED;
+        }
+        else
+        {
+            job->img = img;
+            job->state = ASYNC_IMAGE_DECODED;
+        }
+        iDecodeDone.notify_all();
+    }
+}
+
+void iStartDecodeThreads()
+{
+    // Every image in iGraphics is loaded bottom-up. The flag is global in
+    // stb_image, so set it once before any worker starts reading it.
+    stbi_set_flip_vertically_on_load(true);
+
+    int count = (int)std::thread::hardware_concurrency() - 1;
+    if (count < 1)
+        count = 1;
+    if (count > MAX_DECODE_THREADS)
+        count = MAX_DECODE_THREADS;
+    for (int i = 0; i < count; i++)
+    {
+        // Workers live as long as the program; GLUT exits without returning
+        std::thread(iDecodeWorker).detach();
+    }
+    iDecodeThreadCount = count;
+}
+
+int iLoadImageAsync(const char *filename)
+{
+    if (iDecodeThreadCount == 0)
+        iStartDecodeThreads();
+
+    std::lock_guard<std::mutex> lock(iDecodeMutex);
+    for (int i = 0; i < MAX_ASYNC_IMAGES; i++)
+    {
+        AsyncImage *job = &iAsyncImages[i];
+        if (job->state != ASYNC_IMAGE_FREE)
+            continue;
+
+        snprintf(job->filename, MAX_CACHED_IMAGE_PATH, "%s", filename);
+        job->img.data = nullptr;
+        job->img.width = job->img.height = job->img.channels = 0;
+        job->img.packed = false;
+        job->cancelled = false;
+        job->state = ASYNC_IMAGE_QUEUED;
+
+        iDecodeQueue[(iDecodeQueueHead + iDecodeQueueCount) % MAX_ASYNC_IMAGES] = i;
+        iDecodeQueueCount++;
+        iDecodeWork.notify_one();
+        return i;
+    }
+    printf("Error: Maximum number of async images reached.\n");
+    return -1;
+}
+
+// Called by the engine at the start of every frame
+void iPumpAsyncImages()
+{
+    if (iDecodeThreadCount == 0)
+        return;
+    std::lock_guard<std::mutex> lock(iDecodeMutex);
+    for (int i = 0; i < MAX_ASYNC_IMAGES; i++)
+    {
+        if (iAsyncImages[i].state == ASYNC_IMAGE_DECODED)
+            iAsyncImages[i].state = ASYNC_IMAGE_READY;
+    }
+}
+
+bool iIsImageReady(int handle)
+{
+    if (handle < 0 || handle >= MAX_ASYNC_IMAGES)
+        return false;
+    std::lock_guard<std::mutex> lock(iDecodeMutex);
+    return iAsyncImages[handle].state == ASYNC_IMAGE_READY;
+}
+
+bool iIsImageFailed(int handle)
+{
+    if (handle < 0 || handle >= MAX_ASYNC_IMAGES)
+        return true;
+    std::lock_guard<std::mutex> lock(iDecodeMutex);
+    return iAsyncImages[handle].state == ASYNC_IMAGE_FAILED;
+}
+
+// Returns the image if it is ready, nullptr otherwise
+Image *iGetAsyncImage(int handle)
+{
+    return iIsImageReady(handle) ? &iAsyncImages[handle].img : nullptr;
+}
+
+// Blocks until the image is decoded. Returns nullptr if it failed to load.
+Image *iWaitImage(int handle)
+{
+    if (handle < 0 || handle >= MAX_ASYNC_IMAGES)
+        return nullptr;
+    std::unique_lock<std::mutex> lock(iDecodeMutex);
+    AsyncImage *job = &iAsyncImages[handle];
+    iDecodeDone.wait(lock, [job]
+                     { return job->state != ASYNC_IMAGE_QUEUED; });
+    if (job->state == ASYNC_IMAGE_DECODED)
+        job->state = ASYNC_IMAGE_READY;
+    return (job->state == ASYNC_IMAGE_READY) ? &job->img : nullptr;
+}
+
+// Shows the image if it is ready, or `placeholder` (if any) until then
+void iShowAsyncImage(int x, int y, int handle, Image *placeholder = nullptr)
+{
+    Image *img = iGetAsyncImage(handle);
+    if (img == nullptr)
+        img = placeholder;
+    if (img != nullptr)
+        iShowImage2(x, y, img, -1 /* ignoreColor */);
+}
+
+void iFreeAsyncImage(int handle)
+{
+    if (handle < 0 || handle >= MAX_ASYNC_IMAGES)
+        return;
+    std::lock_guard<std::mutex> lock(iDecodeMutex);
+    AsyncImage *job = &iAsyncImages[handle];
+    if (job->state == ASYNC_IMAGE_QUEUED)
+    {
+        // The worker frees the slot once it is done with it
+        job->cancelled = true;
+        return;
+    }
+    iFreeImage(&job->img);
+    job->state = ASYNC_IMAGE_FREE;
+}
+
+// Reverses the order of `count` pixels in place
+void iReversePixels(unsigned char *pixels, int count, int channels)
+{
+    unsigned char *left = pixels;
+    unsigned char *right = pixels + (count - 1) * channels;
+    while (left < right)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            unsigned char tmp = left[c];
+            left[c] = right[c];
+            right[c] = tmp;
+        }
+        left += channels;
+        right -= channels;
+    }
 }
 
 void iWrapImage(Image *img, int dx)
@@ -284,27 +956,22 @@ void iWrapImage(Image *img, int dx)
     int height = img->height;
     int channels = img->channels;
     unsigned char *data = img->data;
-    unsigned char *wrappedData = new unsigned char[width * height * channels];
 
     // Normalize dx to be within [0, width)
     dx = ((dx % width) + width) % width;
+    if (dx == 0 || !iMakeImageWritable(img))
+        return;
+    iInvalidateResizedImages(img);
+    data = img->data;
 
+    // Rotate each row in place: reverse the row, then reverse both parts
     for (int y = 0; y < height; y++)
     {
-        for (int x = 0; x < width; x++)
-        {
-            int index = (y * width + x) * channels;
-            int wrappedX = (x + dx) % width;
-            int wrappedIndex = (y * width + wrappedX) * channels;
-            for (int c = 0; c < channels; c++)
-            {
-                wrappedData[wrappedIndex + c] = data[index + c];
-            }
-        }
+        unsigned char *row = data + y * width * channels;
+        iReversePixels(row, width, channels);
+        iReversePixels(row, dx, channels);
+        iReversePixels(row + dx * channels, width - dx, channels);
     }
-
-    stbi_image_free(data);
-    img->data = wrappedData;
 }
 
 void iResizeImage(Image *img, int width, int height)
@@ -313,10 +980,15 @@ void iResizeImage(Image *img, int width, int height)
     int imgHeight = img->height;
     int channels = img->channels;
     unsigned char *data = img->data;
-    unsigned char *resizedData = new unsigned char[width * height * channels];
+    unsigned char *resizedData = (unsigned char *)iAllocPixels(width * height * channels);
+    if (resizedData == nullptr)
+        return;
     stbir_resize_uint8(data, imgWidth, imgHeight, 0, resizedData, width, height, 0, channels);
-    stbi_image_free(data);
+    iInvalidateResizedImages(img);
+    if (!img->packed)
+        iFreePixels(data);
     img->data = resizedData;
+    img->packed = false;
     img->width = width;
     img->height = height;
 }
@@ -331,15 +1003,20 @@ void iScaleImage(Image *img, double scale)
 
     int channels = img->channels;
     unsigned char *data = img->data;
-    unsigned char *resizedData = new unsigned char[newWidth * newHeight * channels];
+    unsigned char *resizedData = (unsigned char *)iAllocPixels(newWidth * newHeight * channels);
+    if (resizedData == nullptr)
+        return;
 
     stbir_resize_uint8(
         data, img->width, img->height, 0,
         resizedData, newWidth, newHeight, 0,
         channels);
 
-    stbi_image_free(data);
+    iInvalidateResizedImages(img);
+    if (!img->packed)
+        iFreePixels(data);
     img->data = resizedData;
+    img->packed = false;
     img->width = newWidth;
     img->height = newHeight;
 }
@@ -349,151 +1026,665 @@ void iMirrorImage(Image *img, MirrorState state)
     int width = img->width;
     int height = img->height;
     int channels = img->channels;
+    if (!iMakeImageWritable(img))
+        return;
+    iInvalidateResizedImages(img);
     unsigned char *data = img->data;
-    unsigned char *mirroredData = new unsigned char[width * height * channels];
+    int rowSize = width * channels;
     if (state == HORIZONTAL)
     {
         for (int y = 0; y < height; y++)
         {
-            for (int x = 0; x < width; x++)
+            iReversePixels(data + y * rowSize, width, channels);
+        }
+    }
+    else if (state == VERTICAL)
+    {
+        // Swap rows top-to-bottom in place
+        for (int y = 0; y < height / 2; y++)
+        {
+            unsigned char *top = data + y * rowSize;
+            unsigned char *bottom = data + (height - y - 1) * rowSize;
+            for (int i = 0; i < rowSize; i++)
             {
-                int index = (y * width + x) * channels;
-                int mirroredIndex = (y * width + (width - x - 1)) * channels;
-                for (int c = 0; c < channels; c++)
-                {
-                    mirroredData[mirroredIndex + c] = data[index + c];
-                }
+                unsigned char tmp = top[i];
+                top[i] = bottom[i];
+                bottom[i] = tmp;
             }
         }
     }
-    else if (state == VERTICAL)
+}
+
+// ignorecolor = hex color code 0xRRGGBB
+void iBuildCollisionMask(CollisionMask *mask, const Image *frame, int ignorecolor)
+{
+    int width = frame->width;
+    int height = frame->height;
+    int channels = frame->channels;
+    const unsigned char *data = frame->data;
+    int words = (width + 63) / 64 + 1;
+    int needed = (words + 1) * height; // one extra word per row holds its span
+
+    // Reuse the previous mask buffer unless the frame got bigger
+    if (mask->bits == nullptr || mask->capacity < needed)
+    {
+        iFreePixels(mask->bits);
+        mask->bits = (uint64_t *)iAllocPixels(sizeof(uint64_t) * needed);
+        mask->capacity = (mask->bits != nullptr) ? needed : 0;
+        if (mask->bits == nullptr)
+            return;
+    }
+    mask->spans = (int *)(mask->bits + words * height);
+    mask->width = width;
+    mask->height = height;
+    mask->words = words;
+    memset(mask->bits, 0, sizeof(uint64_t) * words * height);
+
+    for (int y = 0; y < height; y++)
+    {
+        uint64_t *row = mask->bits + y * words;
+        for (int x = 0; x < width; x++)
+        {
+            int index = (y * width + x) * channels;
+
+            unsigned char r = data[index];
+            unsigned char g = (channels > 1) ? data[index + 1] : 0;
+            unsigned char b = (channels > 2) ? data[index + 2] : 0;
+            unsigned char a = (channels == 4) ? data[index + 3] : 255;
+
+            bool isTransparent = (channels == 4 && a == 0);
+
+            bool isIgnoredColor = (ignorecolor == -1 ? false : ((r == (ignorecolor >> 16 & 0xFF)) && (g == ((ignorecolor >> 8) & 0xFF)) && (b == ((ignorecolor) & 0xFF))));
+
+            if (!isTransparent && !isIgnoredColor)
+                row[x >> 6] |= (uint64_t)1 << (x & 63);
+        }
+    }
+
+    // Row spans and the tight bounding box
+    mask->minX = width;
+    mask->minY = height;
+    mask->maxX = -1;
+    mask->maxY = -1;
+    for (int y = 0; y < height; y++)
+    {
+        const uint64_t *row = mask->bits + y * words;
+        int first = width, last = -1;
+        for (int w = 0; w < words; w++)
+        {
+            if (row[w])
+            {
+                first = w * 64 + __builtin_ctzll(row[w]);
+                break;
+            }
+        }
+        for (int w = words - 1; w >= 0; w--)
+        {
+            if (row[w])
+            {
+                last = w * 64 + 63 - __builtin_clzll(row[w]);
+                break;
+            }
+        }
+        mask->spans[2 * y] = first;
+        mask->spans[2 * y + 1] = last;
+        if (first <= last)
+        {
+            mask->minX = (first < mask->minX) ? first : mask->minX;
+            mask->maxX = (last > mask->maxX) ? last : mask->maxX;
+            mask->minY = (y < mask->minY) ? y : mask->minY;
+            mask->maxY = y;
+        }
+    }
+}
+
+void iFreeCollisionMask(CollisionMask *mask)
+{
+    iFreePixels(mask->bits);
+    mask->bits = nullptr;
+    mask->spans = nullptr;
+    mask->capacity = 0;
+}
+
+// Rebuilds the masks of all frames. Called whenever the frame images change,
+// so animating only has to pick the mask of the current frame.
+void iUpdateCollisionMask(Sprite *s)
+{
+    if (!s || !s->frames)
+    {
+        return;
+    }
+    if (s->collisionMaskCount != s->totalFrames)
+    {
+        for (int i = 0; i < s->collisionMaskCount; i++)
+        {
+            iFreeCollisionMask(&s->collisionMasks[i]);
+        }
+        delete[] s->collisionMasks;
+        s->collisionMasks = new CollisionMask[s->totalFrames]();
+        s->collisionMaskCount = s->totalFrames;
+    }
+    for (int i = 0; i < s->totalFrames; i++)
+    {
+        iBuildCollisionMask(&s->collisionMasks[i], &s->frames[i], s->ignoreColor);
+    }
+    s->generation++;
+}
+
+// 64 mask bits starting at pixel `bit` of a row
+inline uint64_t iMaskWindow(const uint64_t *row, int bit)
+{
+    int w = bit >> 6, shift = bit & 63;
+    // (x << 1) << (63 - shift) is x << (64 - shift) without the undefined shift by 64
+    return (row[w] >> shift) | ((row[w + 1] << 1) << (63 - shift));
+}
+
+// True if any of the `count` pixels starting at off1 in row1 and off2 in row2 are both solid
+bool iMaskRowsOverlap(const uint64_t *row1, int off1, const uint64_t *row2, int off2, int count)
+{
+    int k = 0;
+#ifdef __SSE2__
+    // Two windows per step: lane 0 covers bits [k, k+64), lane 1 covers [k+64, k+128)
+    __m128i shift1 = _mm_cvtsi32_si128(off1 & 63), back1 = _mm_cvtsi32_si128(64 - (off1 & 63));
+    __m128i shift2 = _mm_cvtsi32_si128(off2 & 63), back2 = _mm_cvtsi32_si128(64 - (off2 & 63));
+    for (; k + 128 <= count; k += 128)
+    {
+        const uint64_t *p1 = row1 + ((off1 + k) >> 6);
+        const uint64_t *p2 = row2 + ((off2 + k) >> 6);
+        __m128i a = _mm_or_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i *)p1), shift1),
+                                 _mm_sll_epi64(_mm_loadu_si128((const __m128i *)(p1 + 1)), back1));
+        __m128i b = _mm_or_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i *)p2), shift2),
+                                 _mm_sll_epi64(_mm_loadu_si128((const __m128i *)(p2 + 1)), back2));
+        __m128i both = _mm_and_si128(a, b);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(both, _mm_setzero_si128())) != 0xFFFF)
+            return true;
+    }
+#endif
+    for (; k < count; k += 64)
+    {
+        uint64_t both = iMaskWindow(row1, off1 + k) & iMaskWindow(row2, off2 + k);
+        if (count - k < 64)
+            both &= ((uint64_t)1 << (count - k)) - 1;
+        if (both)
+            return true;
+    }
+    return false;
+}
+
+// Tests two sprites without the pair cache. For sprites that do not collide,
+// *gap is how far apart their boxes are: neither can move by gap or more
+// relative to the other, on either axis, without the test having to be redone.
+int iTestSpriteCollision(Sprite *s1, Sprite *s2, int *gap)
+{
+    *gap = 0;
+    int width1 = s1->frames[s1->currentFrame].width;
+    int height1 = s1->frames[s1->currentFrame].height;
+    const CollisionMask *mask1 = s1->collisionMasks ? &s1->collisionMasks[s1->currentFrame] : nullptr;
+
+    int width2 = s2->frames[s2->currentFrame].width;
+    int height2 = s2->frames[s2->currentFrame].height;
+    const CollisionMask *mask2 = s2->collisionMasks ? &s2->collisionMasks[s2->currentFrame] : nullptr;
+
+    int x1 = s1->x;
+    int y1 = s1->y;
+    int x2 = s2->x;
+    int y2 = s2->y;
+
+    // If collisionMasks are not set, check the whole image for collision
+    if (!mask1 || !mask2 || mask1->bits == nullptr || mask2->bits == nullptr)
+    {
+        int startX = (x1 > x2) ? x1 : x2;
+        int endX = (x1 + width1 < x2 + width2) ? x1 + width1 : x2 + width2;
+        int startY = (y1 > y2) ? y1 : y2;
+        int endY = (y1 + height1 < y2 + height2) ? y1 + height1 : y2 + height2;
+        if (startX >= endX || startY >= endY)
+        {
+            *gap = ((startX - endX > startY - endY) ? startX - endX : startY - endY) + 1;
+            return 0;
+        }
+        return 1;
+    }
+
+    // now collisionMasks are set. Intersect the tight boxes of the solid pixels
+    int startX = (x1 + mask1->minX > x2 + mask2->minX) ? x1 + mask1->minX : x2 + mask2->minX;
+    int endX = (x1 + mask1->maxX < x2 + mask2->maxX) ? x1 + mask1->maxX : x2 + mask2->maxX;
+    int startY = (y1 + mask1->minY > y2 + mask2->minY) ? y1 + mask1->minY : y2 + mask2->minY;
+    int endY = (y1 + mask1->maxY < y2 + mask2->maxY) ? y1 + mask1->maxY : y2 + mask2->maxY;
+    if (startX > endX || startY > endY)
+    {
+        *gap = (startX - endX > startY - endY) ? startX - endX : startY - endY;
+        return 0;
+    }
+
+    // Compare whole 64-pixel words of both masks, only where the row spans meet
+    for (int y = startY; y <= endY; y++)
+    {
+        const int *span1 = mask1->spans + 2 * (y - y1);
+        const int *span2 = mask2->spans + 2 * (y - y2);
+        int from = (x1 + span1[0] > x2 + span2[0]) ? x1 + span1[0] : x2 + span2[0];
+        int to = (x1 + span1[1] < x2 + span2[1]) ? x1 + span1[1] : x2 + span2[1];
+        if (from > to)
+        {
+            continue;
+        }
+        const uint64_t *row1 = mask1->bits + (y - y1) * mask1->words;
+        const uint64_t *row2 = mask2->bits + (y - y2) * mask2->words;
+        if (iMaskRowsOverlap(row1, from - x1, row2, from - x2, to - from + 1))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Pair cache: the last result for each pair of sprites, with the state it
+// was computed for. Direct-mapped, a colliding slot is simply overwritten.
+#define COLLISION_CACHE_SIZE 1024 // power of two
+
+typedef struct
+{
+    int id1, id2; // id1 < id2, -1 if the slot is empty
+    int x1, y1, frame1;
+    int x2, y2, frame2;
+    unsigned int generation1, generation2;
+    int result;
+    int gap;
+} CollisionCacheEntry;
+
+CollisionCacheEntry iCollisionCache[COLLISION_CACHE_SIZE];
+bool iCollisionCacheReady = false;
+long long iCollisionCacheHits = 0, iCollisionCacheMisses = 0;
+
+void iClearCollisionCache()
+{
+    for (int i = 0; i < COLLISION_CACHE_SIZE; i++)
+    {
+        iCollisionCache[i].id1 = -1;
+    }
+    iCollisionCacheReady = true;
+}
+
+void iGetCollisionCacheStats(long long *hits, long long *misses)
+{
+    *hits = iCollisionCacheHits;
+    *misses = iCollisionCacheMisses;
+}
+
+void iResetCollisionCacheStats()
+{
+    iCollisionCacheHits = 0;
+    iCollisionCacheMisses = 0;
+}
+
+int iCheckCollision(Sprite *s1, Sprite *s2)
+{
+    if (!s1 || !s2)
+    {
+        return 0;
+    }
+
+    if (!s1->frames || !s2->frames)
+    {
+        return 0;
+    }
+
+    if (!iCollisionCacheReady)
+    {
+        iClearCollisionCache();
+    }
+    // The result does not depend on the order, so key on the lower id first
+    if (s1->id > s2->id)
+    {
+        Sprite *t = s1;
+        s1 = s2;
+        s2 = t;
+    }
+    CollisionCacheEntry *entry = &iCollisionCache[((unsigned int)s1->id * 73856093u ^ (unsigned int)s2->id * 19349663u) & (COLLISION_CACHE_SIZE - 1)];
+    if (entry->id1 == s1->id && entry->id2 == s2->id &&
+        entry->frame1 == s1->currentFrame && entry->frame2 == s2->currentFrame &&
+        entry->generation1 == s1->generation && entry->generation2 == s2->generation)
     {
-        for (int y = 0; y < height; y++)
+        if (entry->x1 == s1->x && entry->y1 == s1->y && entry->x2 == s2->x && entry->y2 == s2->y)
         {
-            int mirroredY = height - y - 1;
-            for (int x = 0; x < width; x++)
-            {
-                int index = (y * width + x) * channels;
-                int mirroredIndex = (mirroredY * width + x) * channels;
-                for (int c = 0; c < channels; c++)
-                {
-                    mirroredData[mirroredIndex + c] = data[index + c];
-                }
-            }
+            iCollisionCacheHits++;
+            return entry->result;
+        }
+        // Moved, but by less than the gap between them: still apart
+        int dx = (s1->x - entry->x1) - (s2->x - entry->x2);
+        int dy = (s1->y - entry->y1) - (s2->y - entry->y2);
+        if (entry->result == 0 && abs(dx) < entry->gap && abs(dy) < entry->gap)
+        {
+            iCollisionCacheHits++;
+            return 0;
         }
     }
-    stbi_image_free(data);
-    img->data = mirroredData;
-}
 
-// ignorecolor = hex color code 0xRRGGBB
-void iUpdateCollisionMask(Sprite *s)
+    iCollisionCacheMisses++;
+    int gap;
+    int result = iTestSpriteCollision(s1, s2, &gap);
+    entry->id1 = s1->id;
+    entry->id2 = s2->id;
+    entry->x1 = s1->x;
+    entry->y1 = s1->y;
+    entry->frame1 = s1->currentFrame;
+    entry->generation1 = s1->generation;
+    entry->x2 = s2->x;
+    entry->y2 = s2->y;
+    entry->frame2 = s2->currentFrame;
+    entry->generation2 = s2->generation;
+    entry->result = result;
+    entry->gap = gap;
+    return result;
+}
+
+// An oriented box: centre, unit axes and half sizes along them
+typedef struct
 {
-    if (!s || !s->frames)
+    double cx, cy;
+    double ux, uy, vx, vy;
+    double hu, hv;
+} OrientedBox;
+
+// Box around the solid pixels of the sprite's current frame, rotated by
+// `degree` (counter-clockwise) about the centre of the frame, as iRotate does
+OrientedBox iGetSpriteBox(const Sprite *s, const CollisionMask *mask, double degree)
+{
+    const Image *frame = &s->frames[s->currentFrame];
+    double minX = 0, minY = 0, maxX = frame->width, maxY = frame->height;
+    if (mask && mask->bits)
     {
-        return;
+        minX = mask->minX;
+        minY = mask->minY;
+        maxX = mask->maxX + 1;
+        maxY = mask->maxY + 1;
     }
-    int ignorecolor = s->ignoreColor;
-    // if (ignorecolor == -1)
-    // {
-    //     s->collisionMask = nullptr;
-    //     return;
-    // }
-
-    Image *frame = &s->frames[s->currentFrame];
-    int width = frame->width;
-    int height = frame->height;
-    int channels = frame->channels;
-    unsigned char *data = frame->data;
-
-    if (s->collisionMask != nullptr)
+    double a = degree * acos(-1.0) / 180.0;
+    double c = cos(a), sn = sin(a);
+    // Box centre relative to the frame centre, then rotated
+    double lx = (minX + maxX) / 2 - frame->width / 2.0;
+    double ly = (minY + maxY) / 2 - frame->height / 2.0;
+    OrientedBox box;
+    box.cx = s->x + frame->width / 2.0 + c * lx - sn * ly;
+    box.cy = s->y + frame->height / 2.0 + sn * lx + c * ly;
+    box.ux = c;
+    box.uy = sn;
+    box.vx = -sn;
+    box.vy = c;
+    box.hu = (maxX - minX) / 2;
+    box.hv = (maxY - minY) / 2;
+    return box;
+}
+
+// Separating axis test on the two axes of each box
+bool iOrientedBoxesOverlap(const OrientedBox *a, const OrientedBox *b)
+{
+    double tx = b->cx - a->cx, ty = b->cy - a->cy;
+    const double axes[4][2] = {{a->ux, a->uy}, {a->vx, a->vy}, {b->ux, b->uy}, {b->vx, b->vy}};
+    for (int i = 0; i < 4; i++)
     {
-        delete[] s->collisionMask;
+        double lx = axes[i][0], ly = axes[i][1];
+        double ra = a->hu * fabs(a->ux * lx + a->uy * ly) + a->hv * fabs(a->vx * lx + a->vy * ly);
+        double rb = b->hu * fabs(b->ux * lx + b->uy * ly) + b->hv * fabs(b->vx * lx + b->vy * ly);
+        if (fabs(tx * lx + ty * ly) > ra + rb + 1e-6) // touching still counts
+            return false;
     }
+    return true;
+}
 
-    unsigned char *collisionMask = new unsigned char[width * height];
+inline bool iMaskBit(const CollisionMask *mask, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= mask->width || y >= mask->height)
+        return false;
+    return (mask->bits[y * mask->words + (x >> 6)] >> (x & 63)) & 1;
+}
 
-    for (int y = 0; y < height; y++)
+// Pixel-level collision of two sprites drawn rotated by degree1 and degree2
+// (counter-clockwise, about the centre of the frame, like
+// iRotate(s->x + width / 2.0, s->y + height / 2.0, degree)). The rotated
+// boxes are tested first; then the solid pixels of one sprite inside the
+// other's box are mapped into the other's mask, so no rotated copies are made.
+int iCheckCollisionRotated(Sprite *s1, double degree1, Sprite *s2, double degree2)
+{
+    if (!s1 || !s2 || !s1->frames || !s2->frames)
     {
-        for (int x = 0; x < width; x++)
-        {
-            int index = (y * width + x) * channels;
+        return 0;
+    }
 
-            unsigned char r = data[index];
-            unsigned char g = (channels > 1) ? data[index + 1] : 0;
-            unsigned char b = (channels > 2) ? data[index + 2] : 0;
-            unsigned char a = (channels == 4) ? data[index + 3] : 255;
+    const CollisionMask *mask1 = s1->collisionMasks ? &s1->collisionMasks[s1->currentFrame] : nullptr;
+    const CollisionMask *mask2 = s2->collisionMasks ? &s2->collisionMasks[s2->currentFrame] : nullptr;
+    if ((mask1 && mask1->bits && mask1->minX > mask1->maxX) || (mask2 && mask2->bits && mask2->minX > mask2->maxX))
+    {
+        return 0; // nothing solid
+    }
+    OrientedBox box1 = iGetSpriteBox(s1, mask1, degree1);
+    OrientedBox box2 = iGetSpriteBox(s2, mask2, degree2);
+    if (!iOrientedBoxesOverlap(&box1, &box2))
+    {
+        return 0;
+    }
+    // If collisionMasks are not set, the boxes decide
+    if (!mask1 || !mask2 || mask1->bits == nullptr || mask2->bits == nullptr)
+    {
+        return 1;
+    }
 
-            bool isTransparent = (channels == 4 && a == 0);
+    // Walk the sprite with fewer solid-box pixels
+    if ((long long)(mask1->maxX - mask1->minX) * (mask1->maxY - mask1->minY) >
+        (long long)(mask2->maxX - mask2->minX) * (mask2->maxY - mask2->minY))
+    {
+        Sprite *ts = s1;
+        s1 = s2;
+        s2 = ts;
+        const CollisionMask *tm = mask1;
+        mask1 = mask2;
+        mask2 = tm;
+        double td = degree1;
+        degree1 = degree2;
+        degree2 = td;
+        OrientedBox tb = box1;
+        box1 = box2;
+        box2 = tb;
+    }
 
-            bool isIgnoredColor = (ignorecolor == -1 ? false : ((r == (ignorecolor >> 16 & 0xFF)) && (g == ((ignorecolor >> 8) & 0xFF)) && (b == ((ignorecolor) & 0xFF))));
+    // Affine map from a pixel of s1 to a pixel of s2: local1 -> screen -> local2
+    const Image *frame1 = &s1->frames[s1->currentFrame];
+    const Image *frame2 = &s2->frames[s2->currentFrame];
+    double a1 = degree1 * acos(-1.0) / 180.0, a2 = degree2 * acos(-1.0) / 180.0;
+    double c1 = cos(a1), sn1 = sin(a1), c2 = cos(a2), sn2 = sin(a2);
+    double h1x = frame1->width / 2.0, h1y = frame1->height / 2.0;
+    double h2x = frame2->width / 2.0, h2y = frame2->height / 2.0;
+    double ox = s1->x + h1x - (s2->x + h2x), oy = s1->y + h1y - (s2->y + h2y); // centre1 - centre2
+    double dc = cos(a1 - a2), ds = sin(a1 - a2);
+    double baseX = h2x + c2 * ox + sn2 * oy; // R(-a2) * (centre1 - centre2) + h2
+    double baseY = h2y - sn2 * ox + c2 * oy;
+
+    // Only the part of s1 inside box2: bound box2's corners in s1's pixels
+    double minU = 1e30, minV = 1e30, maxU = -1e30, maxV = -1e30;
+    for (int k = 0; k < 4; k++)
+    {
+        double su = (k & 1) ? 1 : -1, sv = (k & 2) ? 1 : -1;
+        double wx = box2.cx + su * box2.hu * box2.ux + sv * box2.hv * box2.vx - (s1->x + h1x);
+        double wy = box2.cy + su * box2.hu * box2.uy + sv * box2.hv * box2.vy - (s1->y + h1y);
+        double u = h1x + c1 * wx + sn1 * wy;
+        double v = h1y - sn1 * wx + c1 * wy;
+        minU = fmin(minU, u);
+        maxU = fmax(maxU, u);
+        minV = fmin(minV, v);
+        maxV = fmax(maxV, v);
+    }
+    int startX = (int)fmax(floor(minU), (double)mask1->minX);
+    int endX = (int)fmin(ceil(maxU), (double)mask1->maxX);
+    int startY = (int)fmax(floor(minV), (double)mask1->minY);
+    int endY = (int)fmin(ceil(maxV), (double)mask1->maxY);
 
-            collisionMask[y * width + x] = (isTransparent || isIgnoredColor) ? 0 : 1;
+    for (int y = startY; y <= endY; y++)
+    {
+        int first = mask1->spans[2 * y] > startX ? mask1->spans[2 * y] : startX;
+        int last = mask1->spans[2 * y + 1] < endX ? mask1->spans[2 * y + 1] : endX;
+        const uint64_t *row = mask1->bits + y * mask1->words;
+        double ly = y + 0.5 - h1y;
+        for (int w = first >> 6; first <= last && w <= last >> 6; w++)
+        {
+            uint64_t word = row[w];
+            if (w == first >> 6)
+                word &= ~(uint64_t)0 << (first & 63);
+            // Visit only the solid pixels of this word
+            while (word)
+            {
+                int x = w * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+                if (x > last)
+                    break;
+                double lx = x + 0.5 - h1x;
+                double u = baseX + dc * lx - ds * ly; // R(a1 - a2) * local1
+                double v = baseY + ds * lx + dc * ly;
+                if (iMaskBit(mask2, (int)floor(u), (int)floor(v)))
+                {
+                    return 1;
+                }
+            }
         }
     }
-    s->collisionMask = collisionMask;
+    return 0;
 }
 
-int iCheckCollision(Sprite *s1, Sprite *s2)
+// Result of a swept test: the moving shape touches the box after `time` of
+// its motion (0..1), and normal points from the box towards the shape.
+typedef struct
 {
-    if (!s1 || !s2)
+    float time;
+    float normalX, normalY;
+} SweepHit;
+
+// Moves a circle of `radius` from (x, y) by (dx, dy) against the box at (bx, by)
+// of size bw x bh. The circle is treated as a ray against the box grown by the
+// radius, with rounded corners. Returns true and fills hit if the circle touches
+// the box during the motion. A circle that already touches the box reports a hit
+// at time 0, unless it is moving away from it.
+bool iSweepCircleRect(float x, float y, float radius, float dx, float dy,
+                      float bx, float by, float bw, float bh, SweepHit *hit)
+{
+    // Closest point of the box to the start position
+    float closestX = (x < bx) ? bx : (x > bx + bw ? bx + bw : x);
+    float closestY = (y < by) ? by : (y > by + bh ? by + bh : y);
+    float ox = x - closestX, oy = y - closestY;
+    float distSq = ox * ox + oy * oy;
+    if (distSq <= radius * radius)
     {
-        return 0;
+        float nx, ny;
+        if (distSq > 0)
+        {
+            float dist = sqrtf(distSq);
+            nx = ox / dist;
+            ny = oy / dist;
+        }
+        else
+        {
+            // Centre inside the box: push out through the nearest side
+            float left = x - bx, right = bx + bw - x, bottom = y - by, top = by + bh - y;
+            float least = fminf(fminf(left, right), fminf(bottom, top));
+            nx = (least == left) ? -1 : (least == right ? 1 : 0);
+            ny = (nx != 0) ? 0 : (least == bottom ? -1 : 1);
+        }
+        if (dx * nx + dy * ny >= 0)
+            return false;
+        hit->time = 0;
+        hit->normalX = nx;
+        hit->normalY = ny;
+        return true;
     }
 
-    if (!s1->frames || !s2->frames)
+    if (dx == 0 && dy == 0)
+        return false;
+
+    // Slab test against the box grown by the radius
+    float minX = bx - radius, maxX = bx + bw + radius;
+    float minY = by - radius, maxY = by + bh + radius;
+    float enter = 0, leave = 1;
+    float nx = 0, ny = 0;
+    if (dx == 0)
     {
-        return 0;
+        if (x < minX || x > maxX)
+            return false;
     }
-
-    int width1 = s1->frames[s1->currentFrame].width;
-    int height1 = s1->frames[s1->currentFrame].height;
-    unsigned char *collisionMask1 = s1->collisionMask;
-
-    int width2 = s2->frames[s2->currentFrame].width;
-    int height2 = s2->frames[s2->currentFrame].height;
-    unsigned char *collisionMask2 = s2->collisionMask;
-
-    int x1 = s1->x;
-    int y1 = s1->y;
-    int x2 = s2->x;
-    int y2 = s2->y;
-    // check if the two images overlap
-    int startX = (x1 > x2) ? x1 : x2;
-    int endX = (x1 + width1 < x2 + width2) ? x1 + width1 : x2 + width2;
-    int startY = (y1 > y2) ? y1 : y2;
-    int endY = (y1 + height1 < y2 + height2) ? y1 + height1 : y2 + height2;
-    int noOverlap = startX >= endX || startY >= endY;
-
-    // If collisionMasks are not set, check the whole image for collision
-    if (collisionMask1 == nullptr || collisionMask2 == nullptr)
+    else
     {
-        return noOverlap ? 0 : 1;
+        float t0 = (minX - x) / dx, t1 = (maxX - x) / dx;
+        float side = -1;
+        if (t0 > t1)
+        {
+            float t = t0;
+            t0 = t1;
+            t1 = t;
+            side = 1;
+        }
+        if (t0 > enter)
+        {
+            enter = t0;
+            nx = side;
+            ny = 0;
+        }
+        if (t1 < leave)
+            leave = t1;
+        if (enter > leave)
+            return false;
     }
-    // now collisionMasks are set. Check only the overlapping region
-    if (noOverlap)
+    if (dy == 0)
     {
-        return 0;
+        if (y < minY || y > maxY)
+            return false;
     }
-
-    for (int y = startY; y < endY; y++)
+    else
     {
-        for (int x = startX; x < endX; x++)
+        float t0 = (minY - y) / dy, t1 = (maxY - y) / dy;
+        float side = -1;
+        if (t0 > t1)
         {
-            int ix1 = x - x1;
-            int iy1 = y - y1;
-            int ix2 = x - x2;
-            int iy2 = y - y2;
-
-            int index1 = iy1 * width1 + ix1;
-            int index2 = iy2 * width2 + ix2;
-            if (collisionMask1[index1] && collisionMask2[index2])
-            {
-                return 1;
-            }
+            float t = t0;
+            t0 = t1;
+            t1 = t;
+            side = 1;
+        }
+        if (t0 > enter)
+        {
+            enter = t0;
+            nx = 0;
+            ny = side;
         }
+        if (t1 < leave)
+            leave = t1;
+        if (enter > leave)
+            return false;
     }
-    return 0;
+
+    // Where the centre meets the grown box. Beyond both edges of the real box
+    // means a rounded corner, so test against the circle around that corner.
+    float px = x + dx * enter, py = y + dy * enter;
+    bool outsideX = px < bx || px > bx + bw;
+    bool outsideY = py < by || py > by + bh;
+    if (outsideX && outsideY)
+    {
+        float cx = (px < bx) ? bx : bx + bw;
+        float cy = (py < by) ? by : by + bh;
+        float rx = x - cx, ry = y - cy;
+        float a = dx * dx + dy * dy;
+        float b = rx * dx + ry * dy;
+        float c = rx * rx + ry * ry - radius * radius;
+        float disc = b * b - a * c;
+        if (disc < 0)
+            return false;
+        float t = (-b - sqrtf(disc)) / a;
+        if (t < 0 || t > 1)
+            return false;
+        enter = t;
+        nx = (x + dx * t - cx) / radius;
+        ny = (y + dy * t - cy) / radius;
+    }
+
+    hit->time = enter;
+    hit->normalX = nx;
+    hit->normalY = ny;
+    return true;
 }
 
 void iAnimateSprite(Sprite *sprite)
@@ -502,7 +1693,6 @@ void iAnimateSprite(Sprite *sprite)
         return;
 
     sprite->currentFrame = (sprite->currentFrame + 1) % sprite->totalFrames;
-    iUpdateCollisionMask(sprite);
 }
 
 // Comparison function for sorting filenames
@@ -537,7 +1727,8 @@ void iLoadFramesFromSheet(Image *frames, const char *filename, int rows, int col
         frame->width = frameWidth;
         frame->height = frameHeight;
         frame->channels = tmp.channels;
-        frame->data = new unsigned char[frameWidth * frameHeight * frame->channels];
+        frame->packed = false;
+        frame->data = (unsigned char *)iAllocPixels(frameWidth * frameHeight * frame->channels);
 
         for (int y = 0; y < frameHeight; ++y)
         {
@@ -556,19 +1747,40 @@ void iLoadFramesFromSheet(Image *frames, const char *filename, int rows, int col
         }
     }
 
-    delete[] tmp.data;
+    iFreeImage(&tmp);
 }
 
 #define MAX_FILES 1024
 #define MAX_FILENAME_LEN 512
 
-void iLoadFramesFromFolder(Image *frames, const char *folderPath)
+#define MAX_FRAME_LOAD_ERRORS 16
+
+typedef struct
+{
+    int found;   // files found in the folder
+    int loaded;  // frames written to the output array
+    int failed;  // files that could not be decoded
+    int skipped; // files left out because the output array was full
+    char errors[MAX_FRAME_LOAD_ERRORS][MAX_FILENAME_LEN]; // first few files that failed
+} FrameLoadReport;
+
+//
+// Loads every file in `folderPath`, in sorted filename order, into `frames`.
+// Files are decoded in parallel on up to `maxThreads` threads (0 = one per
+// core). At most `maxFrames` frames are written. Files that fail to decode
+// are left out, so frames[0..n) are always valid images in sorted order.
+// Returns the number of frames loaded.
+//
+int iLoadFramesFromFolder(Image *frames, const char *folderPath, int maxFrames = MAX_FILES, int maxThreads = 0, FrameLoadReport *report = nullptr)
 {
+    if (report != nullptr)
+        memset(report, 0, sizeof(FrameLoadReport));
+
     DIR *dir = opendir(folderPath);
     if (dir == nullptr)
     {
         fprintf(stderr, "Failed to open directory: %s\n", folderPath);
-        return;
+        return 0;
     }
 
     char *filenames[MAX_FILES];
@@ -600,22 +1812,419 @@ void iLoadFramesFromFolder(Image *frames, const char *folderPath)
 
     qsort(filenames, count, sizeof(char *), compareFilenames);
 
-    // Load images in sorted order
+    int total = (count < maxFrames) ? count : maxFrames;
+    Image *decoded = new Image[total > 0 ? total : 1];
+
+    int threadCount = (maxThreads > 0) ? maxThreads : (int)std::thread::hardware_concurrency();
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > total)
+        threadCount = total;
+
+    // Each worker takes the next undecoded index; results land in their sorted slot
+    stbi_set_flip_vertically_on_load(true);
+    std::atomic<int> next(0);
+    auto decodeFrames = [&]()
+    {
+        int i;
+        while ((i = next++) < total)
+        {
+            char fullPath[MAX_FILENAME_LEN];
+            snprintf(fullPath, sizeof(fullPath), "%s/%s", folderPath, filenames[i]);
+            if (!iLoadImageData(fullPath, &decoded[i]))
+                decoded[i].data = nullptr;
+        }
+    };
+
+    std::thread *workers = new std::thread[threadCount > 1 ? threadCount - 1 : 1];
+    for (int t = 0; t < threadCount - 1; t++)
+    {
+        workers[t] = std::thread(decodeFrames);
+    }
+    decodeFrames(); // the calling thread works too
+    for (int t = 0; t < threadCount - 1; t++)
+    {
+        workers[t].join();
+    }
+    delete[] workers;
+
+    int loaded = 0;
+    int failed = 0;
+    for (int i = 0; i < total; ++i)
+    {
+        if (decoded[i].data == nullptr)
+        {
+            fprintf(stderr, "Failed to load image: %s/%s\n", folderPath, filenames[i]);
+            if (report != nullptr && failed < MAX_FRAME_LOAD_ERRORS)
+                snprintf(report->errors[failed], MAX_FILENAME_LEN, "%s", filenames[i]);
+            failed++;
+            continue;
+        }
+        frames[loaded++] = decoded[i];
+    }
+    delete[] decoded;
+
     for (int i = 0; i < count; ++i)
     {
-        char fullPath[MAX_FILENAME_LEN];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", folderPath, filenames[i]);
-        iLoadImage(&frames[i], fullPath);
         free(filenames[i]); // free allocated memory
     }
+
+    if (report != nullptr)
+    {
+        report->found = count;
+        report->loaded = loaded;
+        report->failed = failed;
+        report->skipped = count - total;
+    }
+    return loaded;
+}
+
+// Broadphase for many sprites: a uniform grid hashed into buckets. Each sprite
+// is linked into every cell its frame rectangle covers and is re-linked when it
+// moves to different cells. Pixel masks are only compared for sprites sharing a cell.
+#define MAX_WORLD_SPRITES 1024
+#define MAX_WORLD_CELL_REFS 16384
+#define COLLISION_HASH_BUCKETS 4096 // power of two
+
+typedef struct
+{
+    int entry; // index into CollisionWorld::entries
+    int cellX, cellY;
+    int next; // next ref in the same bucket, -1 ends the chain
+} WorldCellRef;
+
+typedef struct
+{
+    Sprite *sprite; // nullptr if the slot is free
+    int cellX0, cellY0, cellX1, cellY1; // covered cells, inclusive
+    unsigned int stamp;                 // last query that visited this entry
+} WorldEntry;
+
+struct CollisionWorld
+{
+    int cellSize;
+    WorldEntry entries[MAX_WORLD_SPRITES];
+    int entryCount; // entries in use are below this index
+    int buckets[COLLISION_HASH_BUCKETS];
+    WorldCellRef refs[MAX_WORLD_CELL_REFS];
+    int freeRef;
+    unsigned int stamp;
+};
+
+void iInitCollisionWorld(CollisionWorld *world, int cellSize = 64)
+{
+    world->cellSize = (cellSize > 0) ? cellSize : 64;
+    world->entryCount = 0;
+    world->stamp = 0;
+    for (int i = 0; i < COLLISION_HASH_BUCKETS; i++)
+    {
+        world->buckets[i] = -1;
+    }
+    for (int i = 0; i < MAX_WORLD_CELL_REFS; i++)
+    {
+        world->refs[i].next = (i + 1 < MAX_WORLD_CELL_REFS) ? i + 1 : -1;
+    }
+    world->freeRef = 0;
+}
+
+inline int iWorldBucket(int cellX, int cellY)
+{
+    return (int)(((unsigned int)cellX * 73856093u ^ (unsigned int)cellY * 19349663u) & (COLLISION_HASH_BUCKETS - 1));
+}
+
+// Floor division, so cells left of / below the origin get negative indices
+inline int iWorldCell(const CollisionWorld *world, int v)
+{
+    return (v >= 0) ? v / world->cellSize : -((-v + world->cellSize - 1) / world->cellSize);
+}
+
+// Rectangle that holds every frame of the sprite, so animating never needs a re-link
+void iGetSpriteBounds(const Sprite *s, int *x, int *y, int *width, int *height)
+{
+    *x = s->x;
+    *y = s->y;
+    *width = 0;
+    *height = 0;
+    for (int i = 0; i < s->totalFrames; i++)
+    {
+        if (s->frames[i].width > *width)
+            *width = s->frames[i].width;
+        if (s->frames[i].height > *height)
+            *height = s->frames[i].height;
+    }
+}
+
+void iUnlinkWorldEntry(CollisionWorld *world, int index)
+{
+    WorldEntry *entry = &world->entries[index];
+    for (int cy = entry->cellY0; cy <= entry->cellY1; cy++)
+    {
+        for (int cx = entry->cellX0; cx <= entry->cellX1; cx++)
+        {
+            int *link = &world->buckets[iWorldBucket(cx, cy)];
+            while (*link != -1)
+            {
+                WorldCellRef *ref = &world->refs[*link];
+                if (ref->entry == index && ref->cellX == cx && ref->cellY == cy)
+                {
+                    int freed = *link;
+                    *link = ref->next;
+                    ref->next = world->freeRef;
+                    world->freeRef = freed;
+                    break;
+                }
+                link = &ref->next;
+            }
+        }
+    }
+}
+
+bool iLinkWorldEntry(CollisionWorld *world, int index)
+{
+    WorldEntry *entry = &world->entries[index];
+    for (int cy = entry->cellY0; cy <= entry->cellY1; cy++)
+    {
+        for (int cx = entry->cellX0; cx <= entry->cellX1; cx++)
+        {
+            if (world->freeRef == -1)
+            {
+                // The cells linked so far stay linked; unlinking skips the missing ones
+                printf("Error: Collision world is out of cell references.\n");
+                return false;
+            }
+            int r = world->freeRef;
+            WorldCellRef *ref = &world->refs[r];
+            world->freeRef = ref->next;
+            ref->entry = index;
+            ref->cellX = cx;
+            ref->cellY = cy;
+            int bucket = iWorldBucket(cx, cy);
+            ref->next = world->buckets[bucket];
+            world->buckets[bucket] = r;
+        }
+    }
+    return true;
+}
+
+// Re-links the sprite if its bounds now cover different cells. Called by
+// iSetSpritePosition and after the frames change; call it yourself if you
+// change s->x or s->y directly.
+void iUpdateCollisionWorld(CollisionWorld *world, Sprite *s)
+{
+    if (!world || !s || s->world != world)
+        return;
+
+    int x, y, width, height;
+    iGetSpriteBounds(s, &x, &y, &width, &height);
+    int cellX0 = iWorldCell(world, x);
+    int cellY0 = iWorldCell(world, y);
+    int cellX1 = iWorldCell(world, x + (width > 0 ? width - 1 : 0));
+    int cellY1 = iWorldCell(world, y + (height > 0 ? height - 1 : 0));
+
+    WorldEntry *entry = &world->entries[s->worldIndex];
+    if (entry->cellX0 == cellX0 && entry->cellY0 == cellY0 && entry->cellX1 == cellX1 && entry->cellY1 == cellY1)
+        return;
+
+    iUnlinkWorldEntry(world, s->worldIndex);
+    entry->cellX0 = cellX0;
+    entry->cellY0 = cellY0;
+    entry->cellX1 = cellX1;
+    entry->cellY1 = cellY1;
+    iLinkWorldEntry(world, s->worldIndex);
+}
+
+bool iAddToCollisionWorld(CollisionWorld *world, Sprite *s)
+{
+    if (!world || !s || s->world != nullptr)
+        return false;
+
+    int index = -1;
+    for (int i = 0; i < world->entryCount; i++)
+    {
+        if (world->entries[i].sprite == nullptr)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1)
+    {
+        if (world->entryCount >= MAX_WORLD_SPRITES)
+        {
+            printf("Error: Maximum number of sprites in the collision world reached.\n");
+            return false;
+        }
+        index = world->entryCount++;
+    }
+
+    WorldEntry *entry = &world->entries[index];
+    entry->sprite = s;
+    entry->stamp = world->stamp;
+    // An empty range, so the update below links every cell
+    entry->cellX0 = entry->cellY0 = 1;
+    entry->cellX1 = entry->cellY1 = 0;
+    s->world = world;
+    s->worldIndex = index;
+    iUpdateCollisionWorld(world, s);
+    return true;
+}
+
+void iRemoveFromCollisionWorld(Sprite *s)
+{
+    if (!s || s->world == nullptr)
+        return;
+
+    CollisionWorld *world = s->world;
+    iUnlinkWorldEntry(world, s->worldIndex);
+    world->entries[s->worldIndex].sprite = nullptr;
+    while (world->entryCount > 0 && world->entries[world->entryCount - 1].sprite == nullptr)
+    {
+        world->entryCount--;
+    }
+    s->world = nullptr;
+    s->worldIndex = -1;
+}
+
+// Calls visit(entryIndex) once for every sprite linked into a cell of the rectangle
+template <typename Visit>
+void iVisitWorldRect(CollisionWorld *world, int x, int y, int width, int height, Visit visit)
+{
+    if (++world->stamp == 0)
+    {
+        // Stamp wrapped around: clear the old ones so nothing is skipped by mistake
+        for (int i = 0; i < world->entryCount; i++)
+            world->entries[i].stamp = 0;
+        world->stamp = 1;
+    }
+    int cellX0 = iWorldCell(world, x);
+    int cellY0 = iWorldCell(world, y);
+    int cellX1 = iWorldCell(world, x + (width > 0 ? width - 1 : 0));
+    int cellY1 = iWorldCell(world, y + (height > 0 ? height - 1 : 0));
+    for (int cy = cellY0; cy <= cellY1; cy++)
+    {
+        for (int cx = cellX0; cx <= cellX1; cx++)
+        {
+            for (int r = world->buckets[iWorldBucket(cx, cy)]; r != -1; r = world->refs[r].next)
+            {
+                const WorldCellRef *ref = &world->refs[r];
+                WorldEntry *entry = &world->entries[ref->entry];
+                if (ref->cellX != cx || ref->cellY != cy || entry->stamp == world->stamp)
+                    continue;
+                entry->stamp = world->stamp;
+                visit(ref->entry);
+            }
+        }
+    }
+}
+
+inline bool iRectsOverlap(int x1, int y1, int w1, int h1, int x2, int y2, int w2, int h2)
+{
+    return x1 < x2 + w2 && x2 < x1 + w1 && y1 < y2 + h2 && y2 < y1 + h1;
+}
+
+// Sprites whose current frame rectangle overlaps the given rectangle.
+// Returns how many were found; at most maxResults are written to results.
+int iQueryCollisionRect(CollisionWorld *world, int x, int y, int width, int height, Sprite **results, int maxResults)
+{
+    int found = 0;
+    iVisitWorldRect(world, x, y, width, height, [&](int index)
+                    {
+                        Sprite *s = world->entries[index].sprite;
+                        if (!s->frames || s->currentFrame < 0)
+                            return;
+                        const Image *frame = &s->frames[s->currentFrame];
+                        if (!iRectsOverlap(x, y, width, height, s->x, s->y, frame->width, frame->height))
+                            return;
+                        if (found < maxResults)
+                            results[found] = s;
+                        found++;
+                    });
+    return found;
+}
+
+// Sprites in the world that collide with s, tested with iCheckCollision.
+// s does not have to be in the world itself.
+int iQueryCollisionSprite(CollisionWorld *world, Sprite *s, Sprite **results, int maxResults)
+{
+    if (!s || !s->frames || s->currentFrame < 0)
+        return 0;
+
+    int found = 0;
+    const Image *frame = &s->frames[s->currentFrame];
+    iVisitWorldRect(world, s->x, s->y, frame->width, frame->height, [&](int index)
+                    {
+                        Sprite *other = world->entries[index].sprite;
+                        if (other == s || !iCheckCollision(s, other))
+                            return;
+                        if (found < maxResults)
+                            results[found] = other;
+                        found++;
+                    });
+    return found;
+}
+
+typedef struct
+{
+    Sprite *a, *b;
+} WorldPair;
+
+// Calls onCollision(a, b) once for every colliding pair of sprites in the world.
+// The pairs are collected first and reported after the grid walk, so the
+// callback may move or remove sprites and query the world. A pair is skipped
+// if either sprite was removed by an earlier call.
+void iForEachCollision(CollisionWorld *world, void (*onCollision)(Sprite *a, Sprite *b))
+{
+    WorldPair *pairs = nullptr;
+    int pairCount = 0, pairCapacity = 0;
+    for (int i = 0; i < world->entryCount; i++)
+    {
+        Sprite *s = world->entries[i].sprite;
+        if (s == nullptr || !s->frames || s->currentFrame < 0)
+            continue;
+        const Image *frame = &s->frames[s->currentFrame];
+        iVisitWorldRect(world, s->x, s->y, frame->width, frame->height, [&](int index)
+                        {
+                            // Each pair is reported by its lower index only
+                            if (index <= i)
+                                return;
+                            Sprite *other = world->entries[index].sprite;
+                            if (!iCheckCollision(s, other))
+                                return;
+                            if (pairCount == pairCapacity)
+                            {
+                                int capacity = pairCapacity ? pairCapacity * 2 : 64;
+                                WorldPair *grown = (WorldPair *)realloc(pairs, sizeof(WorldPair) * capacity);
+                                if (grown == nullptr)
+                                {
+                                    printf("Error: Out of memory collecting collision pairs.\n");
+                                    return;
+                                }
+                                pairs = grown;
+                                pairCapacity = capacity;
+                            }
+                            pairs[pairCount++] = {s, other};
+                        });
+    }
+    for (int i = 0; i < pairCount; i++)
+    {
+        if (pairs[i].a->world == world && pairs[i].b->world == world)
+            onCollision(pairs[i].a, pairs[i].b);
+    }
+    free(pairs);
 }
 
 void iInitSprite(Sprite *s, int ignoreColor = -1)
 {
+    static int nextSpriteId = 0;
+    s->id = nextSpriteId++;
+    s->world = nullptr;
+    s->worldIndex = -1;
     s->x = 0;
     s->y = 0;
 
-    s->collisionMask = nullptr;
+    s->collisionMasks = nullptr;
+    s->collisionMaskCount = 0;
+    s->generation = 0;
     s->ignoreColor = ignoreColor;
 
     // Assign the pre-loaded frames to the sprite
@@ -633,9 +2242,10 @@ void deepCopyImage(Image src, Image *dst)
     dst->width = src.width;
     dst->height = src.height;
     dst->channels = src.channels;
+    dst->packed = false;
 
     // Allocate memory for the image data in the destination
-    dst->data = (unsigned char *)malloc(src.width * src.height * src.channels);
+    dst->data = (unsigned char *)iAllocPixels(src.width * src.height * src.channels);
     if (dst->data == NULL)
     {
         // Handle memory allocation failure
@@ -660,6 +2270,7 @@ void iScaleSprite(Sprite *s, double scale)
     }
 
     iUpdateCollisionMask(s);
+    iUpdateCollisionWorld(s->world, s);
 }
 
 void iChangeSpriteFrames(Sprite *s, const Image *frames, int totalFrames)
@@ -683,7 +2294,6 @@ void iChangeSpriteFrames(Sprite *s, const Image *frames, int totalFrames)
 
     s->currentFrame = 0;
     s->totalFrames = totalFrames;
-    s->collisionMask = nullptr;
 
     // Apply transformations to each frame
     for (int i = 0; i < s->totalFrames; ++i)
@@ -697,12 +2307,14 @@ void iChangeSpriteFrames(Sprite *s, const Image *frames, int totalFrames)
     }
 
     iUpdateCollisionMask(s);
+    iUpdateCollisionWorld(s->world, s);
 }
 
 void iSetSpritePosition(Sprite *s, int x, int y)
 {
     s->x = x;
     s->y = y;
+    iUpdateCollisionWorld(s->world, s);
 }
 
 void iShowSprite(const Sprite *s)
@@ -721,6 +2333,7 @@ void iResizeSprite(Sprite *s, int width, int height)
         iResizeImage(frame, width, height);
     }
     iUpdateCollisionMask(s);
+    iUpdateCollisionWorld(s->world, s);
 }
 
 // void iWrapSprite(Sprite *s, int dx)
@@ -753,15 +2366,19 @@ void iMirrorSprite(Sprite *s, MirrorState state)
 
 void iFreeSprite(Sprite *s)
 {
+    iRemoveFromCollisionWorld(s);
     for (int i = 0; i < s->totalFrames; ++i)
     {
         iFreeImage(&s->frames[i]);
     }
     delete[] s->frames;
-    if (s->collisionMask != nullptr)
+    for (int i = 0; i < s->collisionMaskCount; i++)
     {
-        delete[] s->collisionMask;
+        iFreeCollisionMask(&s->collisionMasks[i]);
     }
+    delete[] s->collisionMasks;
+    s->collisionMasks = nullptr;
+    s->collisionMaskCount = 0;
 }
 
 void iGetPixelColor(int cursorX, int cursorY, int rgb[])
@@ -1058,6 +2675,61 @@ void iUnRotate()
     glPopMatrix();
 }
 
+// Draws the sprite rotated about the centre of its frame, the same
+// rotation iCheckCollisionRotated uses. glDrawPixels (iShowImage2) only
+// moves with iRotate and is never turned, so the frame is drawn as a
+// textured quad instead.
+void iShowSpriteRotated(const Sprite *s, double degree)
+{
+    if (!s || !s->frames)
+        return;
+
+    const Image *frame = &s->frames[s->currentFrame];
+    int width = frame->width, height = frame->height, channels = frame->channels;
+    // RGBA copy with the ignored colour made transparent (the alpha test drops it)
+    unsigned char *pixels = (unsigned char *)iFrameAlloc((size_t)width * height * 4);
+    if (pixels == nullptr)
+        return;
+    for (int i = 0; i < width * height; i++)
+    {
+        const unsigned char *src = frame->data + (size_t)i * channels;
+        unsigned char *dst = pixels + (size_t)i * 4;
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = (channels == 4) ? src[3] : 255;
+        if (s->ignoreColor != -1 && src[0] == (s->ignoreColor >> 16 & 0xFF) &&
+            src[1] == ((s->ignoreColor >> 8) & 0xFF) && src[2] == (s->ignoreColor & 0xFF))
+            dst[3] = 0;
+    }
+
+    static GLuint texture = 0;
+    if (texture == 0)
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE); // not tinted by iSetColor
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    glEnable(GL_TEXTURE_2D);
+    iRotate(s->x + width / 2.0, s->y + height / 2.0, degree);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2d(s->x, s->y);
+    glTexCoord2f(1, 0);
+    glVertex2d(s->x + width, s->y);
+    glTexCoord2f(1, 1);
+    glVertex2d(s->x + width, s->y + height);
+    glTexCoord2f(0, 1);
+    glVertex2d(s->x, s->y + height);
+    glEnd();
+    iUnRotate();
+    glDisable(GL_TEXTURE_2D);
+}
+
 void iSetColor(int r, int g, int b)
 {
     glColor3f(r / 255.0, g / 255.0, b / 255.0);
@@ -1097,8 +2769,10 @@ void iClear()
 void displayFF(void)
 {
     // iClear();
+    iPumpAsyncImages();
     iDraw();
     glutSwapBuffers();
+    iResetFrameArena();
 }
 
 void animFF(void)
@@ -0,0 +1,325 @@
+//
+//  Levels: glyph grids of any size loaded from level text files or from an
+//  open asset pack (see iPack.h). The file is read with one call and split
+//  into rows in a single scan, so load time grows linearly with its size.
+//
+//  Cells are row-major, row 0 is the first line of the file and short lines
+//  are padded with '.', the same layout tools/iPacker.cpp stores.
+//
+//  Compiled levels (.lvl, built offline with tools/iLevelCompiler.cpp) are
+//  loaded with a single read and used in place:
+//      LevelFileHeader
+//      tiles                    (rows * cols glyphs, padded to LEVEL_ALIGN)
+//      LevelRect[rectCount]     (solid '#' tiles merged into rectangles)
+//      LevelSpawnList[spawnListCount]
+//      LevelSpawn[spawnCount]   (grouped by glyph, row-major within a group)
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "iPack.h"
+#include "iTiles.h"
+
+#define LEVEL_MAGIC "IGLV"
+#define LEVEL_VERSION 1
+#define LEVEL_ALIGN 8
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    int32_t rows, cols;
+    uint32_t rectCount;
+    uint32_t spawnListCount;
+    uint32_t spawnCount;
+    uint32_t reserved;
+} LevelFileHeader;
+
+// Solid tiles merged by iMergeSolidTiles(), stored as they are
+typedef TileRect LevelRect;
+
+// The spawns of one glyph, e.g. every 'c' in the level
+typedef struct
+{
+    char glyph;
+    char reserved[3];
+    uint32_t first; // index of the first spawn
+    uint32_t count;
+} LevelSpawnList;
+
+typedef struct
+{
+    int32_t row, col;
+} LevelSpawn;
+
+typedef struct
+{
+    char *cells; // rows * cols glyphs, no line breaks
+    int rows, cols;
+    // Only set for compiled levels
+    const LevelRect *rects;
+    int rectCount;
+    const LevelSpawnList *spawnLists;
+    int spawnListCount;
+    const LevelSpawn *spawns;
+    int spawnCount;
+    char *data;      // the one allocation cells (and the tables) live in
+    size_t capacity; // bytes allocated for data
+} Level;
+
+inline size_t iLevelTileBytes(int rows, int cols)
+{
+    return ((size_t)rows * cols + LEVEL_ALIGN - 1) / LEVEL_ALIGN * LEVEL_ALIGN;
+}
+
+inline char *iLevelRow(const Level *level, int row)
+{
+    return level->cells + (size_t)row * level->cols;
+}
+
+inline char iLevelAt(const Level *level, int row, int col)
+{
+    if (row < 0 || col < 0 || row >= level->rows || col >= level->cols)
+        return '.';
+    return level->cells[(size_t)row * level->cols + col];
+}
+
+// Makes sure data holds `size` bytes, reusing the old buffer when it is big enough
+bool iReserveLevel(Level *level, size_t size)
+{
+    if (level->data == nullptr || level->capacity < size)
+    {
+        char *data = (char *)malloc(size > 0 ? size : 1);
+        if (data == nullptr)
+        {
+            printf("Failed to allocate %zu bytes for a level\n", size);
+            return false;
+        }
+        free(level->data);
+        level->data = data;
+        level->capacity = size;
+    }
+    return true;
+}
+
+// Makes room for rows * cols cells; the level has no rects or spawns afterwards
+bool iResizeLevel(Level *level, int rows, int cols)
+{
+    if (!iReserveLevel(level, (size_t)rows * cols))
+        return false;
+    level->cells = level->data;
+    level->rows = rows;
+    level->cols = cols;
+    level->rects = nullptr;
+    level->rectCount = 0;
+    level->spawnLists = nullptr;
+    level->spawnListCount = 0;
+    level->spawns = nullptr;
+    level->spawnCount = 0;
+    return true;
+}
+
+// Splits `text` into a grid. Line starts are collected while the widest line
+// is measured, then each line is copied once.
+bool iParseLevel(Level *level, const char *text, size_t size)
+{
+    int lineCapacity = 256, lines = 0, cols = 0;
+    size_t *starts = (size_t *)malloc(lineCapacity * sizeof(size_t));
+    if (starts == nullptr)
+        return false;
+
+    size_t start = 0;
+    for (size_t i = 0; i <= size; i++)
+    {
+        if (i < size && text[i] != '\n')
+            continue;
+        size_t end = i;
+        if (end > start && text[end - 1] == '\r')
+            end--;
+        if (i < size || end > start) // no empty row after the last line break
+        {
+            if (lines == lineCapacity)
+            {
+                lineCapacity *= 2;
+                size_t *grown = (size_t *)realloc(starts, lineCapacity * sizeof(size_t));
+                if (grown == nullptr)
+                {
+                    free(starts);
+                    return false;
+                }
+                starts = grown;
+            }
+            starts[lines++] = start;
+            if ((int)(end - start) > cols)
+                cols = (int)(end - start);
+        }
+        start = i + 1;
+    }
+
+    if (!iResizeLevel(level, lines, cols))
+    {
+        free(starts);
+        return false;
+    }
+    for (int row = 0; row < lines; row++)
+    {
+        size_t from = starts[row];
+        size_t to = (row + 1 < lines) ? starts[row + 1] - 1 : size;
+        while (to > from && (text[to - 1] == '\n' || text[to - 1] == '\r'))
+            to--;
+        char *dst = iLevelRow(level, row);
+        memcpy(dst, text + from, to - from);
+        memset(dst + (to - from), '.', cols - (to - from));
+    }
+    free(starts);
+    return true;
+}
+
+// Size of a compiled level with these counts, or 0 if they do not fit in `size`
+size_t iCompiledLevelSize(const LevelFileHeader *header, size_t size)
+{
+    if (size < sizeof(LevelFileHeader) || memcmp(header->magic, LEVEL_MAGIC, 4) != 0 ||
+        header->version != LEVEL_VERSION || header->rows < 0 || header->cols < 0)
+        return 0;
+    size_t needed = sizeof(LevelFileHeader) + iLevelTileBytes(header->rows, header->cols) +
+                    (size_t)header->rectCount * sizeof(LevelRect) +
+                    (size_t)header->spawnListCount * sizeof(LevelSpawnList) +
+                    (size_t)header->spawnCount * sizeof(LevelSpawn);
+    return needed <= size ? needed : 0;
+}
+
+// Loads a level built with iLevelCompiler: one read into the level's buffer,
+// then the tables are used where they landed
+bool iLoadCompiledLevel(Level *level, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        printf("Failed to open level: %s\n", filename);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // Read into a new buffer so a bad file leaves the current level alone
+    char *data = (char *)malloc(size > 0 ? size : 1);
+    if (data == nullptr || (long)fread(data, 1, size, file) != size)
+    {
+        free(data);
+        fclose(file);
+        printf("Failed to read level: %s\n", filename);
+        return false;
+    }
+    fclose(file);
+
+    const LevelFileHeader *header = (const LevelFileHeader *)data;
+    if (iCompiledLevelSize(header, size) == 0)
+    {
+        free(data);
+        printf("Invalid compiled level: %s\n", filename);
+        return false;
+    }
+
+    free(level->data);
+    level->data = data;
+    level->capacity = size;
+    level->rows = header->rows;
+    level->cols = header->cols;
+    level->cells = data + sizeof(LevelFileHeader);
+    const char *p = level->cells + iLevelTileBytes(header->rows, header->cols);
+    level->rects = (const LevelRect *)p;
+    level->rectCount = header->rectCount;
+    p += header->rectCount * sizeof(LevelRect);
+    level->spawnLists = (const LevelSpawnList *)p;
+    level->spawnListCount = header->spawnListCount;
+    p += header->spawnListCount * sizeof(LevelSpawnList);
+    level->spawns = (const LevelSpawn *)p;
+    level->spawnCount = header->spawnCount;
+    for (int i = 0; i < level->spawnListCount; i++)
+    {
+        const LevelSpawnList *list = &level->spawnLists[i];
+        if (list->first > (uint32_t)level->spawnCount || list->count > level->spawnCount - list->first)
+        {
+            printf("Invalid compiled level: %s\n", filename);
+            level->spawnListCount = i; // keep the lists that are valid
+            break;
+        }
+    }
+    return true;
+}
+
+// The spawns of `glyph` in a compiled level, nullptr if there are none
+const LevelSpawn *iFindSpawns(const Level *level, char glyph, int *count)
+{
+    for (int i = 0; i < level->spawnListCount; i++)
+    {
+        if (level->spawnLists[i].glyph == glyph)
+        {
+            *count = level->spawnLists[i].count;
+            return level->spawns + level->spawnLists[i].first;
+        }
+    }
+    *count = 0;
+    return nullptr;
+}
+
+inline bool iIsCompiledLevelName(const char *filename)
+{
+    size_t length = strlen(filename);
+    return length >= 4 && strcmp(filename + length - 4, ".lvl") == 0;
+}
+
+// Loads a level from the open asset packs, or from the file if no pack has it.
+// .lvl files are compiled levels (see iLoadCompiledLevel).
+// The cells are a private copy, so the game may change them (e.g. collected items).
+bool iLoadLevel(Level *level, const char *filename)
+{
+    if (iIsCompiledLevelName(filename))
+        return iLoadCompiledLevel(level, filename);
+
+    int packedRows = 0, packedCols = 0;
+    const char *packed = iFindPackedLevel(filename, &packedRows, &packedCols);
+    if (packed)
+    {
+        if (!iResizeLevel(level, packedRows, packedCols))
+            return false;
+        memcpy(level->cells, packed, (size_t)packedRows * packedCols);
+        return true;
+    }
+
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        printf("Failed to open level: %s\n", filename);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = (char *)malloc(size > 0 ? size : 1);
+    if (text == nullptr)
+    {
+        fclose(file);
+        printf("Failed to allocate level: %s\n", filename);
+        return false;
+    }
+    size = fread(text, 1, size, file);
+    fclose(file);
+
+    bool loaded = iParseLevel(level, text, size);
+    free(text);
+    if (!loaded)
+        printf("Failed to load level: %s\n", filename);
+    return loaded;
+}
+
+void iFreeLevel(Level *level)
+{
+    free(level->data);
+    memset(level, 0, sizeof(Level));
+}
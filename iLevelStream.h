@@ -0,0 +1,831 @@
+//
+//  Level streaming: a level is split into chunks of chunkWidth columns and
+//  only the chunks around the view are kept in memory. A loader thread
+//  indexes the file when the stream is opened and reads chunks ahead of the
+//  camera, so neither the memory used nor the work per frame depends on the
+//  length of the level.
+//
+//  The loaded chunks form one window of columns, contiguous in memory, which
+//  can be used as a TileGrid (see iGetStreamTileGrid). Text levels, compiled
+//  .lvl levels and levels in an open asset pack can all be streamed.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "iLevel.h"
+#include "iTiles.h"
+#include "iSnapshot.h"
+
+#define MAX_STREAM_CHUNKS 32 // chunks resident per stream
+#define MAX_STREAM_JOBS 256
+#define MAX_STREAM_PATH 256
+
+enum LevelStreamState
+{
+    STREAM_CLOSED,
+    STREAM_OPENING, // the loader is indexing the file
+    STREAM_OPEN,
+    STREAM_FAILED
+};
+
+enum StreamChunkState
+{
+    STREAM_CHUNK_FREE,
+    STREAM_CHUNK_QUEUED,
+    STREAM_CHUNK_LOADING,
+    STREAM_CHUNK_LOADED // read by the loader, not yet copied into the window
+};
+
+typedef struct
+{
+    int row, col;
+    char glyph;
+} StreamSpawn;
+
+typedef struct
+{
+    char filename[MAX_STREAM_PATH];
+    int chunkWidth;     // columns per chunk
+    int prefetchChunks; // chunks kept loaded past each side of the view
+    int windowChunks;   // chunks resident at once
+    int state;          // LevelStreamState, changed by the loader
+    bool ready;         // the game's thread has seen the stream open
+
+    // Set by the loader when the level has been indexed
+    int rows, cols, chunkCount;
+    long *rowOffsets;       // where each row starts in the file
+    int *rowLengths;        // glyphs in each row
+    const char *packed;     // rows * cols glyphs if the level is in an asset pack
+    FILE *file;             // only used by the loader
+    int glyphCounts[256];   // tiles holding each glyph (only entity glyphs for compiled levels)
+    int startRow, startCol; // the first '@', -1 if there is none
+    bool spawnGlyph[256];   // glyphs whose tiles are listed in spawns
+    StreamSpawn *spawns;    // in file order (grouped by glyph for compiled levels)
+    int spawnCount;
+    LevelRect *rects;       // the merged solid tiles of a compiled level, nullptr otherwise
+    int rectCount;
+    bool trackGlyph[256];   // glyphs whose tiles keep their changes (see iSetStreamTile)
+    StreamSpawn *tracked;   // the tiles holding them, by column and then row
+    int trackedCount;
+    int *chunkTracked;      // chunkCount + 1 entries: chunk c's tracked tiles start at chunkTracked[c]
+
+    // rows x (windowChunks * chunkWidth) glyphs, level chunk firstChunk at column 0.
+    // Only the game's thread touches the window.
+    char *window;
+    int firstChunk;
+    bool resident[MAX_STREAM_CHUNKS]; // window chunk i (level chunk firstChunk + i) is loaded
+
+    // One rows x chunkWidth buffer per slot for the loader to read into
+    char *staging;
+    int stagingChunk[MAX_STREAM_CHUNKS];
+    int stagingState[MAX_STREAM_CHUNKS];
+    int busy; // jobs of this stream queued or running
+
+    char *trackedGlyphs; // what each tracked tile holds now, kept when chunks reload
+    bool solidEdited;    // a '#' was added or removed, so the rects no longer match
+} LevelStream;
+
+typedef struct
+{
+    LevelStream *stream;
+    int slot; // staging slot to read a chunk into, -1 to index the level
+} StreamJob;
+
+StreamJob iStreamJobs[MAX_STREAM_JOBS];
+int iStreamJobHead = 0, iStreamJobCount = 0;
+bool iStreamThreadStarted = false;
+// Never destroyed: the detached loader may still be waiting on them at exit()
+std::mutex &iStreamMutex = *new std::mutex();
+std::condition_variable &iStreamWork = *new std::condition_variable(); // a job was queued
+std::condition_variable &iStreamDone = *new std::condition_variable(); // a job finished
+
+inline int iStreamWindowCols(const LevelStream *stream)
+{
+    return stream->windowChunks * stream->chunkWidth;
+}
+
+bool iAddStreamRow(LevelStream *stream, int *capacity, long offset, int length)
+{
+    if (stream->rows == *capacity)
+    {
+        *capacity *= 2;
+        long *offsets = (long *)realloc(stream->rowOffsets, *capacity * sizeof(long));
+        if (offsets)
+            stream->rowOffsets = offsets;
+        int *lengths = (int *)realloc(stream->rowLengths, *capacity * sizeof(int));
+        if (lengths)
+            stream->rowLengths = lengths;
+        if (!offsets || !lengths)
+            return false;
+    }
+    stream->rowOffsets[stream->rows] = offset;
+    stream->rowLengths[stream->rows] = length;
+    stream->rows++;
+    if (length > stream->cols)
+        stream->cols = length;
+    return true;
+}
+
+bool iAddStreamTile(StreamSpawn **tiles, int *count, int *capacity, int row, int col, char glyph)
+{
+    if (*count == *capacity)
+    {
+        int grown = *capacity > 0 ? *capacity * 2 : 256;
+        StreamSpawn *grownTiles = (StreamSpawn *)realloc(*tiles, grown * sizeof(StreamSpawn));
+        if (!grownTiles)
+            return false;
+        *tiles = grownTiles;
+        *capacity = grown;
+    }
+    (*tiles)[(*count)++] = {row, col, glyph};
+    return true;
+}
+
+bool iAddStreamSpawn(LevelStream *stream, int *capacity, int row, int col, char glyph)
+{
+    return iAddStreamTile(&stream->spawns, &stream->spawnCount, capacity, row, col, glyph);
+}
+
+bool iAddStreamTracked(LevelStream *stream, int *capacity, int row, int col, char glyph)
+{
+    return iAddStreamTile(&stream->tracked, &stream->trackedCount, capacity, row, col, glyph);
+}
+
+// Records where each row of a text level starts, counts the glyphs and finds
+// the start, reading the file a block at a time
+bool iIndexTextLevel(LevelStream *stream)
+{
+    stream->file = fopen(stream->filename, "rb");
+    if (!stream->file)
+    {
+        printf("Failed to open level: %s\n", stream->filename);
+        return false;
+    }
+
+    int capacity = 256;
+    stream->rowOffsets = (long *)malloc(capacity * sizeof(long));
+    stream->rowLengths = (int *)malloc(capacity * sizeof(int));
+    if (!stream->rowOffsets || !stream->rowLengths)
+        return false;
+
+    static char block[1 << 16]; // only the loader thread uses it
+    long position = 0, lineStart = 0;
+    int length = 0, spawnCapacity = 0, trackedCapacity = 0;
+    bool open = false; // the current row has glyphs
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), stream->file)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            unsigned char c = block[i];
+            if (c == '\n')
+            {
+                if (!iAddStreamRow(stream, &capacity, lineStart, length))
+                    return false;
+                lineStart = position + (long)i + 1;
+                length = 0;
+                open = false;
+                continue;
+            }
+            if (c == '\r')
+                continue; // only ever before a '\n' in a level file
+            if (c == '@' && stream->startRow < 0)
+            {
+                stream->startRow = stream->rows;
+                stream->startCol = length;
+            }
+            if (stream->spawnGlyph[c] && !iAddStreamSpawn(stream, &spawnCapacity, stream->rows, length, c))
+                return false;
+            if (stream->trackGlyph[c] && !iAddStreamTracked(stream, &trackedCapacity, stream->rows, length, c))
+                return false;
+            stream->glyphCounts[c]++;
+            length++;
+            open = true;
+        }
+        position += (long)n;
+    }
+    // The last line may have no line break
+    if (open && !iAddStreamRow(stream, &capacity, lineStart, length))
+        return false;
+    return true;
+}
+
+// Compiled levels have fixed-width rows, and the spawn lists give the counts and spawns
+bool iIndexCompiledLevel(LevelStream *stream)
+{
+    stream->file = fopen(stream->filename, "rb");
+    if (!stream->file)
+    {
+        printf("Failed to open level: %s\n", stream->filename);
+        return false;
+    }
+    fseek(stream->file, 0, SEEK_END);
+    long size = ftell(stream->file);
+    fseek(stream->file, 0, SEEK_SET);
+    LevelFileHeader header;
+    if (fread(&header, sizeof(header), 1, stream->file) != 1 || iCompiledLevelSize(&header, size) == 0)
+    {
+        printf("Invalid compiled level: %s\n", stream->filename);
+        return false;
+    }
+
+    stream->rows = header.rows;
+    stream->cols = header.cols;
+    stream->rowOffsets = (long *)malloc((header.rows > 0 ? header.rows : 1) * sizeof(long));
+    stream->rowLengths = (int *)malloc((header.rows > 0 ? header.rows : 1) * sizeof(int));
+    if (!stream->rowOffsets || !stream->rowLengths)
+        return false;
+    for (int r = 0; r < header.rows; r++)
+    {
+        stream->rowOffsets[r] = (long)sizeof(LevelFileHeader) + (long)r * header.cols;
+        stream->rowLengths[r] = header.cols;
+    }
+
+    // The merged solid tiles, kept for iGetStreamRects()
+    long rects = (long)sizeof(LevelFileHeader) + (long)iLevelTileBytes(header.rows, header.cols);
+    stream->rects = (LevelRect *)malloc((header.rectCount > 0 ? header.rectCount : 1) * sizeof(LevelRect));
+    if (!stream->rects)
+        return false;
+    fseek(stream->file, rects, SEEK_SET);
+    if (fread(stream->rects, sizeof(LevelRect), header.rectCount, stream->file) != header.rectCount)
+        return false;
+    stream->rectCount = header.rectCount;
+
+    long lists = rects + (long)header.rectCount * sizeof(LevelRect);
+    long spawns = lists + (long)header.spawnListCount * sizeof(LevelSpawnList);
+    int spawnCapacity = 0, trackedCapacity = 0;
+    for (uint32_t i = 0; i < header.spawnListCount; i++)
+    {
+        LevelSpawnList list;
+        fseek(stream->file, lists + (long)i * sizeof(LevelSpawnList), SEEK_SET);
+        if (fread(&list, sizeof(list), 1, stream->file) != 1)
+            return false;
+        stream->glyphCounts[(unsigned char)list.glyph] += list.count;
+        LevelSpawn start;
+        if (list.glyph == '@' && list.count > 0 && list.first < header.spawnCount)
+        {
+            fseek(stream->file, spawns + (long)list.first * sizeof(LevelSpawn), SEEK_SET);
+            if (fread(&start, sizeof(start), 1, stream->file) == 1)
+            {
+                stream->startRow = start.row;
+                stream->startCol = start.col;
+            }
+        }
+        bool spawn = stream->spawnGlyph[(unsigned char)list.glyph];
+        bool track = stream->trackGlyph[(unsigned char)list.glyph];
+        if ((spawn || track) && list.first <= header.spawnCount && list.count <= header.spawnCount - list.first)
+        {
+            fseek(stream->file, spawns + (long)list.first * sizeof(LevelSpawn), SEEK_SET);
+            for (uint32_t k = 0; k < list.count; k++)
+            {
+                if (fread(&start, sizeof(start), 1, stream->file) != 1 ||
+                    (spawn && !iAddStreamSpawn(stream, &spawnCapacity, start.row, start.col, list.glyph)) ||
+                    (track && !iAddStreamTracked(stream, &trackedCapacity, start.row, start.col, list.glyph)))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool iIndexPackedLevel(LevelStream *stream)
+{
+    int rows, cols;
+    stream->packed = iFindPackedLevel(stream->filename, &rows, &cols);
+    stream->rows = rows;
+    stream->cols = cols;
+    stream->rowOffsets = (long *)malloc((rows > 0 ? rows : 1) * sizeof(long));
+    stream->rowLengths = (int *)malloc((rows > 0 ? rows : 1) * sizeof(int));
+    if (!stream->rowOffsets || !stream->rowLengths)
+        return false;
+    int spawnCapacity = 0, trackedCapacity = 0;
+    for (int r = 0; r < rows; r++)
+    {
+        stream->rowOffsets[r] = (long)r * cols;
+        stream->rowLengths[r] = cols;
+        const char *row = stream->packed + (size_t)r * cols;
+        for (int c = 0; c < cols; c++)
+        {
+            if (row[c] == '@' && stream->startRow < 0)
+            {
+                stream->startRow = r;
+                stream->startCol = c;
+            }
+            if (stream->spawnGlyph[(unsigned char)row[c]] && !iAddStreamSpawn(stream, &spawnCapacity, r, c, row[c]))
+                return false;
+            if (stream->trackGlyph[(unsigned char)row[c]] && !iAddStreamTracked(stream, &trackedCapacity, r, c, row[c]))
+                return false;
+            stream->glyphCounts[(unsigned char)row[c]]++;
+        }
+    }
+    return true;
+}
+
+int iCompareStreamTiles(const void *a, const void *b)
+{
+    const StreamSpawn *ta = (const StreamSpawn *)a, *tb = (const StreamSpawn *)b;
+    if (ta->col != tb->col)
+        return ta->col < tb->col ? -1 : 1;
+    return (ta->row > tb->row) - (ta->row < tb->row);
+}
+
+// Sorts the tracked tiles by column and finds where each chunk's tiles start
+bool iIndexStreamTracked(LevelStream *stream)
+{
+    if (stream->trackedCount > 0)
+        qsort(stream->tracked, stream->trackedCount, sizeof(StreamSpawn), iCompareStreamTiles);
+    stream->chunkTracked = (int *)malloc((stream->chunkCount + 1) * sizeof(int));
+    stream->trackedGlyphs = (char *)malloc(stream->trackedCount > 0 ? stream->trackedCount : 1);
+    if (!stream->chunkTracked || !stream->trackedGlyphs)
+        return false;
+    int t = 0;
+    for (int c = 0; c <= stream->chunkCount; c++)
+    {
+        while (t < stream->trackedCount && stream->tracked[t].col < c * stream->chunkWidth)
+            t++;
+        stream->chunkTracked[c] = t;
+    }
+    for (int i = 0; i < stream->trackedCount; i++)
+        stream->trackedGlyphs[i] = stream->tracked[i].glyph;
+    return true;
+}
+
+// Runs on the loader thread
+bool iIndexStreamLevel(LevelStream *stream)
+{
+    int rows, cols;
+    bool indexed;
+    if (iFindPackedLevel(stream->filename, &rows, &cols))
+        indexed = iIndexPackedLevel(stream);
+    else if (iIsCompiledLevelName(stream->filename))
+        indexed = iIndexCompiledLevel(stream);
+    else
+        indexed = iIndexTextLevel(stream);
+    if (!indexed)
+        return false;
+
+    stream->chunkCount = (stream->cols + stream->chunkWidth - 1) / stream->chunkWidth;
+    if (!iIndexStreamTracked(stream))
+    {
+        printf("Failed to index the tracked tiles of level: %s\n", stream->filename);
+        return false;
+    }
+    size_t size = (size_t)stream->rows * iStreamWindowCols(stream);
+    stream->window = (char *)malloc(size > 0 ? size : 1);
+    stream->staging = (char *)malloc(size > 0 ? size : 1);
+    if (!stream->window || !stream->staging)
+    {
+        printf("Failed to allocate the window for level: %s\n", stream->filename);
+        return false;
+    }
+    memset(stream->window, '.', size);
+    return true;
+}
+
+// Runs on the loader thread. Rows shorter than the chunk are padded with '.'.
+void iReadStreamChunk(LevelStream *stream, int chunk, char *out)
+{
+    int col0 = chunk * stream->chunkWidth;
+    for (int r = 0; r < stream->rows; r++)
+    {
+        char *dst = out + (size_t)r * stream->chunkWidth;
+        int n = stream->rowLengths[r] - col0;
+        if (n > stream->chunkWidth)
+            n = stream->chunkWidth;
+        if (n < 0)
+            n = 0;
+        if (n > 0 && stream->packed)
+        {
+            memcpy(dst, stream->packed + stream->rowOffsets[r] + col0, n);
+        }
+        else if (n > 0)
+        {
+            fseek(stream->file, stream->rowOffsets[r] + col0, SEEK_SET);
+            n = (int)fread(dst, 1, n, stream->file);
+        }
+        memset(dst + n, '.', stream->chunkWidth - n);
+    }
+}
+
+void iStreamWorker()
+{
+    while (true)
+    {
+        StreamJob job;
+        int chunk = -1;
+        {
+            std::unique_lock<std::mutex> lock(iStreamMutex);
+            iStreamWork.wait(lock, []
+                             { return iStreamJobCount > 0; });
+            job = iStreamJobs[iStreamJobHead];
+            iStreamJobHead = (iStreamJobHead + 1) % MAX_STREAM_JOBS;
+            iStreamJobCount--;
+            if (job.slot >= 0)
+            {
+                job.stream->stagingState[job.slot] = STREAM_CHUNK_LOADING;
+                chunk = job.stream->stagingChunk[job.slot];
+            }
+        }
+
+        LevelStream *stream = job.stream;
+        bool indexed = false;
+        if (job.slot < 0)
+            indexed = iIndexStreamLevel(stream);
+        else
+            iReadStreamChunk(stream, chunk, stream->staging + (size_t)job.slot * stream->rows * stream->chunkWidth);
+
+        std::lock_guard<std::mutex> lock(iStreamMutex);
+        if (job.slot < 0)
+            stream->state = indexed ? STREAM_OPEN : STREAM_FAILED;
+        else
+            stream->stagingState[job.slot] = STREAM_CHUNK_LOADED;
+        stream->busy--;
+        iStreamDone.notify_all();
+    }
+}
+
+// Must be called with iStreamMutex held
+bool iQueueStreamJob(LevelStream *stream, int slot)
+{
+    if (iStreamJobCount >= MAX_STREAM_JOBS)
+        return false;
+    if (!iStreamThreadStarted)
+    {
+        // The loader lives as long as the program; GLUT exits without returning
+        std::thread(iStreamWorker).detach();
+        iStreamThreadStarted = true;
+    }
+    iStreamJobs[(iStreamJobHead + iStreamJobCount) % MAX_STREAM_JOBS] = {stream, slot};
+    iStreamJobCount++;
+    stream->busy++;
+    iStreamWork.notify_one();
+    return true;
+}
+
+// Stops the loading, then frees the window and closes the file. The stream
+// can be opened again afterwards.
+void iCloseLevelStream(LevelStream *stream)
+{
+    if (stream->state == STREAM_CLOSED)
+        return;
+    {
+        // Drop the jobs not started yet and wait for the one in progress
+        std::unique_lock<std::mutex> lock(iStreamMutex);
+        int kept = 0;
+        for (int i = 0; i < iStreamJobCount; i++)
+        {
+            StreamJob job = iStreamJobs[(iStreamJobHead + i) % MAX_STREAM_JOBS];
+            if (job.stream == stream)
+                stream->busy--;
+            else
+                iStreamJobs[(iStreamJobHead + kept++) % MAX_STREAM_JOBS] = job;
+        }
+        iStreamJobCount = kept;
+        iStreamDone.wait(lock, [stream]
+                         { return stream->busy == 0; });
+    }
+
+    if (stream->file)
+        fclose(stream->file);
+    free(stream->rowOffsets);
+    free(stream->rowLengths);
+    free(stream->window);
+    free(stream->staging);
+    free(stream->spawns);
+    free(stream->rects);
+    free(stream->tracked);
+    free(stream->chunkTracked);
+    free(stream->trackedGlyphs);
+    memset(stream, 0, sizeof(LevelStream));
+}
+
+// Starts loading a level in the background and returns at once. viewCols is
+// how many columns fit on screen; prefetchChunks chunks of chunkWidth columns
+// are kept loaded past each side of the view. The level can be used once
+// iIsLevelStreamOpen() is true. The loader also lists every tile holding
+// one of spawnGlyphs (e.g. "P|x") in stream->spawns, for placing entities,
+// and indexes the tiles holding one of trackGlyphs (e.g. "*" for items), so
+// changes to them are kept (see iSetStreamTile).
+// `stream` must be zero-initialized (e.g. a global) or closed; a stream that
+// is open is closed first.
+bool iOpenLevelStream(LevelStream *stream, const char *filename, int viewCols, int chunkWidth = 32, int prefetchChunks = 1,
+                      const char *spawnGlyphs = nullptr, const char *trackGlyphs = nullptr)
+{
+    iCloseLevelStream(stream);
+    if (chunkWidth < 1)
+        chunkWidth = 1;
+    if (prefetchChunks < 0)
+        prefetchChunks = 0;
+    // A view can straddle one more chunk than it covers
+    int windowChunks = (viewCols + chunkWidth - 1) / chunkWidth + 1 + 2 * prefetchChunks;
+    if (windowChunks > MAX_STREAM_CHUNKS)
+    {
+        printf("Error: A %d column view with %d chunks of prefetch needs more than %d chunks of %d columns.\n",
+               viewCols, prefetchChunks, MAX_STREAM_CHUNKS, chunkWidth);
+        return false;
+    }
+
+    snprintf(stream->filename, MAX_STREAM_PATH, "%s", filename);
+    stream->chunkWidth = chunkWidth;
+    stream->prefetchChunks = prefetchChunks;
+    stream->windowChunks = windowChunks;
+    stream->startRow = stream->startCol = -1;
+    for (const char *g = spawnGlyphs; g && *g; g++)
+        stream->spawnGlyph[(unsigned char)*g] = true;
+    for (const char *g = trackGlyphs; g && *g; g++)
+        stream->trackGlyph[(unsigned char)*g] = true;
+    stream->state = STREAM_OPENING;
+
+    std::lock_guard<std::mutex> lock(iStreamMutex);
+    if (!iQueueStreamJob(stream, -1))
+    {
+        printf("Error: Too many level streaming jobs.\n");
+        stream->state = STREAM_FAILED;
+        return false;
+    }
+    return true;
+}
+
+bool iIsLevelStreamOpen(LevelStream *stream)
+{
+    std::lock_guard<std::mutex> lock(iStreamMutex);
+    if (stream->state == STREAM_OPEN)
+        stream->ready = true;
+    return stream->ready;
+}
+
+bool iIsLevelStreamFailed(LevelStream *stream)
+{
+    std::lock_guard<std::mutex> lock(iStreamMutex);
+    return stream->state == STREAM_FAILED;
+}
+
+// Copies a chunk the loader has read into the window and puts back what its tracked tiles hold now
+void iPlaceStreamChunk(LevelStream *stream, int k, const char *chunk)
+{
+    int windowCols = iStreamWindowCols(stream);
+    int chunkIndex = stream->firstChunk + k;
+    for (int r = 0; r < stream->rows; r++)
+    {
+        memcpy(stream->window + (size_t)r * windowCols + k * stream->chunkWidth,
+               chunk + (size_t)r * stream->chunkWidth, stream->chunkWidth);
+    }
+    for (int t = stream->chunkTracked[chunkIndex]; t < stream->chunkTracked[chunkIndex + 1]; t++)
+    {
+        const StreamSpawn *tile = &stream->tracked[t];
+        stream->window[(size_t)tile->row * windowCols + tile->col - stream->firstChunk * stream->chunkWidth] = stream->trackedGlyphs[t];
+    }
+    stream->resident[k] = true;
+}
+
+// Moves the window so it starts at chunk `first`, keeping the chunks both windows share
+void iShiftStreamWindow(LevelStream *stream, int first)
+{
+    int shift = first - stream->firstChunk;
+    int windowChunks = stream->windowChunks;
+    int windowCols = iStreamWindowCols(stream);
+    int width = stream->chunkWidth;
+    int kept = windowChunks - abs(shift);
+    for (int r = 0; r < stream->rows; r++)
+    {
+        char *row = stream->window + (size_t)r * windowCols;
+        if (kept <= 0)
+            memset(row, '.', windowCols);
+        else if (shift > 0)
+        {
+            memmove(row, row + shift * width, (size_t)kept * width);
+            memset(row + kept * width, '.', (size_t)shift * width);
+        }
+        else
+        {
+            memmove(row - shift * width, row, (size_t)kept * width);
+            memset(row, '.', (size_t)-shift * width);
+        }
+    }
+
+    bool resident[MAX_STREAM_CHUNKS];
+    for (int k = 0; k < windowChunks; k++)
+    {
+        int old = k + shift;
+        resident[k] = old >= 0 && old < windowChunks && stream->resident[old];
+    }
+    memcpy(stream->resident, resident, sizeof(resident));
+    stream->firstChunk = first;
+}
+
+// Call once per tick with the first level column on screen. Moves the window
+// with the view, takes in the chunks the loader has read and asks for the
+// missing ones, nearest to the view first. Returns true if the window changed
+// (rebuild anything made from it, e.g. with iGetStreamTileGrid()).
+bool iUpdateLevelStream(LevelStream *stream, int viewCol)
+{
+    std::lock_guard<std::mutex> lock(iStreamMutex);
+    if (stream->state != STREAM_OPEN)
+        return false;
+    stream->ready = true;
+
+    bool changed = false;
+    int viewChunk = (viewCol > 0 ? viewCol : 0) / stream->chunkWidth;
+    int first = viewChunk - stream->prefetchChunks;
+    if (first > stream->chunkCount - stream->windowChunks)
+        first = stream->chunkCount - stream->windowChunks;
+    if (first < 0)
+        first = 0;
+    if (first != stream->firstChunk)
+    {
+        iShiftStreamWindow(stream, first);
+        changed = true;
+    }
+
+    size_t chunkSize = (size_t)stream->rows * stream->chunkWidth;
+    for (int s = 0; s < stream->windowChunks; s++)
+    {
+        if (stream->stagingState[s] != STREAM_CHUNK_LOADED)
+            continue;
+        int k = stream->stagingChunk[s] - stream->firstChunk;
+        if (k >= 0 && k < stream->windowChunks && !stream->resident[k])
+        {
+            iPlaceStreamChunk(stream, k, stream->staging + s * chunkSize);
+            changed = true;
+        }
+        stream->stagingState[s] = STREAM_CHUNK_FREE;
+    }
+
+    // Outwards from the view: viewChunk, viewChunk + 1, viewChunk - 1, ...
+    for (int step = 0; step < 2 * stream->windowChunks; step++)
+    {
+        int chunk = viewChunk + ((step & 1) ? -(step + 1) / 2 : step / 2);
+        int k = chunk - stream->firstChunk;
+        if (chunk >= stream->chunkCount || k < 0 || k >= stream->windowChunks || stream->resident[k])
+            continue;
+        int slot = -1;
+        bool pending = false;
+        for (int s = 0; s < stream->windowChunks; s++)
+        {
+            if (stream->stagingState[s] == STREAM_CHUNK_FREE)
+            {
+                if (slot < 0)
+                    slot = s;
+            }
+            else if (stream->stagingChunk[s] == chunk)
+            {
+                pending = true;
+            }
+        }
+        if (pending)
+            continue;
+        if (slot < 0)
+            break;
+        stream->stagingChunk[slot] = chunk;
+        stream->stagingState[slot] = STREAM_CHUNK_QUEUED;
+        if (!iQueueStreamJob(stream, slot))
+        {
+            stream->stagingState[slot] = STREAM_CHUNK_FREE;
+            break;
+        }
+    }
+    return changed;
+}
+
+// True if every chunk holding columns col0..col1 is in the window
+bool iIsStreamRangeLoaded(const LevelStream *stream, int col0, int col1)
+{
+    if (!stream->ready)
+        return false;
+    if (col0 < 0)
+        col0 = 0;
+    if (col1 >= stream->cols)
+        col1 = stream->cols - 1;
+    for (int chunk = col0 / stream->chunkWidth; chunk <= col1 / stream->chunkWidth; chunk++)
+    {
+        int k = chunk - stream->firstChunk;
+        if (k < 0 || k >= stream->windowChunks || !stream->resident[k])
+            return false;
+    }
+    return true;
+}
+
+// True once every chunk of the window that is inside the level is loaded
+bool iIsStreamWindowLoaded(const LevelStream *stream)
+{
+    if (!stream->ready)
+        return false;
+    for (int k = 0; k < stream->windowChunks && stream->firstChunk + k < stream->chunkCount; k++)
+    {
+        if (!stream->resident[k])
+            return false;
+    }
+    return true;
+}
+
+// Glyph at (row, col), or '.' if that part of the level is not loaded
+inline char iGetStreamTile(const LevelStream *stream, int row, int col)
+{
+    if (!stream->ready || row < 0 || row >= stream->rows || col < 0 || col >= stream->cols)
+        return '.';
+    int k = col / stream->chunkWidth - stream->firstChunk;
+    if (k < 0 || k >= stream->windowChunks || !stream->resident[k])
+        return '.';
+    return stream->window[(size_t)row * iStreamWindowCols(stream) + col - stream->firstChunk * stream->chunkWidth];
+}
+
+// Index of the tracked tile at (row, col), or -1 if that tile is not tracked
+int iFindStreamTracked(const LevelStream *stream, int row, int col)
+{
+    int chunk = col / stream->chunkWidth;
+    int lo = stream->chunkTracked[chunk], hi = stream->chunkTracked[chunk + 1] - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        const StreamSpawn *tile = &stream->tracked[mid];
+        if (tile->col == col && tile->row == row)
+            return mid;
+        if (tile->col < col || (tile->col == col && tile->row < row))
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+// Changes a tile (e.g. a collected item). A tile that held one of the
+// trackGlyphs of iOpenLevelStream keeps the change when its chunk is unloaded
+// and loaded again. Any other tile is only changed while its chunk is
+// loaded, and false is returned.
+bool iSetStreamTile(LevelStream *stream, int row, int col, char glyph)
+{
+    if (!stream->ready || row < 0 || row >= stream->rows || col < 0 || col >= stream->cols)
+        return false;
+    int k = col / stream->chunkWidth - stream->firstChunk;
+    bool loaded = k >= 0 && k < stream->windowChunks && stream->resident[k];
+    int t = iFindStreamTracked(stream, row, col);
+    if (t < 0 && !loaded)
+        return false;
+    char old = (t >= 0) ? stream->trackedGlyphs[t] : iGetStreamTile(stream, row, col);
+    if (glyph == '#' || old == '#')
+        stream->solidEdited = true;
+    if (loaded)
+        stream->window[(size_t)row * iStreamWindowCols(stream) + col - stream->firstChunk * stream->chunkWidth] = glyph;
+    if (t < 0)
+        return false;
+    stream->trackedGlyphs[t] = glyph;
+    return true;
+}
+
+// A TileGrid over the window; columns keep their level numbers (grid->firstCol)
+void iGetStreamTileGrid(const LevelStream *stream, TileGrid *grid, int tileWidth, int tileHeight, int topY)
+{
+    int firstCol = stream->firstChunk * stream->chunkWidth;
+    int cols = stream->cols - firstCol;
+    if (cols > iStreamWindowCols(stream))
+        cols = iStreamWindowCols(stream);
+    if (cols < 0)
+        cols = 0;
+    iInitTileGrid(grid, stream->window, iStreamWindowCols(stream), stream->rows, cols, tileWidth, tileHeight, topY);
+    grid->firstCol = firstCol;
+}
+
+// The '#' tiles of `grid` (from iGetStreamTileGrid) merged into rectangles,
+// e.g. to collide with a few rectangles instead of every solid tile. A
+// compiled level's rects are clipped to the grid's columns, and also cover
+// the chunks still loading; otherwise, or once a solid tile was edited, the
+// grid is merged on the spot. Returns the
+// number of rectangles; at most maxRects are written to rects.
+int iGetStreamRects(const LevelStream *stream, const TileGrid *grid, TileRect *rects, int maxRects)
+{
+    if (stream->rects == nullptr || stream->solidEdited)
+        return iMergeSolidTiles(grid, rects, maxRects, '#');
+    int col0 = grid->firstCol, col1 = grid->firstCol + grid->cols;
+    int count = 0;
+    for (int i = 0; i < stream->rectCount; i++)
+    {
+        TileRect rect = stream->rects[i];
+        int left = rect.col > col0 ? rect.col : col0;
+        int right = rect.col + rect.cols < col1 ? rect.col + rect.cols : col1;
+        if (left >= right)
+            continue;
+        if (count < maxRects)
+            rects[count] = {rect.row, left, rect.rows, right - left};
+        count++;
+    }
+    return count;
+}
+
+// Adds the parts of an open stream that change during play (the window and
+// the tracked tiles) to a snapshot. Restoring it puts the loaded chunks and every
+// tile change back as they were; the snapshot is only valid until the stream
+// is closed or opened again.
+bool iAddStreamToSnapshot(Snapshot *snapshot, LevelStream *stream)
+{
+    return stream->ready &&
+           iAddSnapshotRegion(snapshot, stream->window, (size_t)stream->rows * iStreamWindowCols(stream)) &&
+           iAddSnapshotVariable(snapshot, stream->firstChunk) &&
+           iAddSnapshotVariable(snapshot, stream->resident) &&
+           iAddSnapshotRegion(snapshot, stream->trackedGlyphs, stream->trackedCount);
+}
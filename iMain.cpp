@@ -1,5 +1,8 @@
 #include "iGraphics.h"
 #include "iSound.h"
+#include "iTiles.h"
+#include "iSnapshot.h"
+#include "iRewind.h"
 
 // defining game state
 typedef enum
@@ -23,7 +26,8 @@ bool bgmplaying = false;
 int collectorX[collector_count] = {152, 352, 552, 752, 902};
 int collectorY[collector_count] = {125, 205, 285, 365, 445};
 int collectorsize = 20;
-bool collectorvisible[collector_count] = {true, true, true};
+bool collectorvisible[collector_count] = {true, true, true, true, true};
+CollectibleIndex collectorIndex; // visible collectors, by column
 // score
 int score = 0;
 char scoreText[20];
@@ -56,40 +60,85 @@ int enemyStartX = 300; // Starting X
 // Victory area
 int goalX = 970, goalY = 460, goalW = 40, goalH = 20;
 
-void updateBall()
+// The game as it is before Start is pressed, put back on every Start
+Snapshot startState;
+// The same state recorded every tick, hold 'z' to rewind
+Rewind history;
+
+// Rebuilds the index from the visible collectors
+void resetCollectors()
 {
-    ballDY += gravity;
-    ballY += ballDY;
-    onGround = false;
-    // Collectibles collision
+    Collectible items[collector_count];
+    int count = 0;
     for (int i = 0; i < collector_count; i++)
     {
         if (collectorvisible[i])
         {
-            int dx = ballX - collectorX[i];
-            int dy = ballY - collectorY[i];
-            if (dx * dx + dy * dy <= (ballRadius + collectorsize / 2) * (ballRadius + collectorsize / 2))
-            {
-                collectorvisible[i] = false;
-                score += 50;
-                iPlaySound("assets/sounds/chime.wav", false);
-            }
+            items[count].x = collectorX[i];
+            items[count].y = collectorY[i];
+            items[count].id = i;
+            items[count].row = items[count].col = -1;
+            count++;
         }
     }
+    iBuildCollectibleIndex(&collectorIndex, items, count, 100);
+}
 
-    // Platform collision
+// Registers everything that changes during a game and saves it as it is now.
+// The collector index is rebuilt from collectorvisible after a restore.
+void takeStartState()
+{
+    iAddSnapshotVariable(&startState, ballX);
+    iAddSnapshotVariable(&startState, ballY);
+    iAddSnapshotVariable(&startState, ballDY);
+    iAddSnapshotVariable(&startState, onGround);
+    iAddSnapshotVariable(&startState, collectorvisible);
+    iAddSnapshotVariable(&startState, score);
+    iAddSnapshotVariable(&startState, enemyX);
+    iAddSnapshotVariable(&startState, enemyDir);
+    iTakeSnapshot(&startState);
+}
+
+void updateBall()
+{
+    ballDY += gravity;
+    onGround = false;
+
+    // Platform collision: sweep the fall so a fast ball lands on the first
+    // platform below it instead of passing through. Platforms are one-way,
+    // the ball only lands when coming down with its centre over the top.
+    int landedOn = -1;
+    float landingTime = 1;
     for (int i = 0; i < PLATFORM_COUNT; i++)
     {
-        if (ballY - ballRadius <= platformY[i] + platformH &&
-            ballY - ballRadius >= platformY[i] &&
-            ballX >= platformX[i] &&
-            ballX <= platformX[i] + platformW)
+        SweepHit hit;
+        if (iSweepCircleRect(ballX, ballY, ballRadius, 0, ballDY, platformX[i], platformY[i], platformW, platformH, &hit) &&
+            hit.normalY > 0 && ballX >= platformX[i] && ballX <= platformX[i] + platformW && hit.time <= landingTime)
         {
-            ballY = platformY[i] + platformH + ballRadius;
-            ballDY = 0;
-            onGround = true;
+            landedOn = i;
+            landingTime = hit.time;
         }
     }
+    if (landedOn >= 0)
+    {
+        ballY = platformY[landedOn] + platformH + ballRadius;
+        ballDY = 0;
+        onGround = true;
+    }
+    else
+    {
+        ballY += ballDY;
+    }
+
+    // Collectibles collision, only against collectors near the ball
+    Collectible collected[collector_count];
+    int count = iCollectNear(&collectorIndex, ballX, ballY, ballRadius + collectorsize / 2, collected, collector_count);
+    for (int i = 0; i < count; i++)
+    {
+        collectorvisible[collected[i].id] = false;
+        score += 50;
+        iPlaySound("assets/sounds/chime.wav", false);
+    }
 
     // Ground check
     if (ballY <= 0)
@@ -307,12 +356,10 @@ void iMouse(int button, int state, int mx, int my)
             // Start
             if (mx >= btnX && mx <= btnX + btnW && my >= btnY && my <= btnY + btnH)
             {
+                iRestoreSnapshot(&startState);
+                resetCollectors();
+                iClearRewind(&history);
                 currentState = STATE_GAME;
-                score = 0;
-                for (int i = 0; i < collector_count; i++)
-                {
-                    collectorvisible[i] = true;
-                }
             }
             // Instructions
             else if (mx >= btnX + 1 * (btnW + gap) && mx <= btnX + 1 * (btnW + gap) + btnW &&
@@ -399,8 +446,15 @@ void iTimer()
 {
     if (currentState == STATE_GAME)
     {
+        if (isKeyPressed('z'))
+        {
+            if (iRewind(&history, 1) > 0)
+                resetCollectors();
+            return;
+        }
         updateBall();
         updateEnemy();
+        iRecordRewindFrame(&history);
         /*static int frameCount = 0;
          frameCount++;
          if (frameCount >= 100) {
@@ -415,6 +469,11 @@ int main(int argc, char *argv[])
     glutInit(&argc, argv);
     // place your own initization codes here.
     iInitializeSound();
+    iOpenAssetPack("assets.pak");
+    resetCollectors();
+    takeStartState();
+    // 5 minutes at 200 ticks a second, a keyframe every second
+    iInitRewind(&history, &startState, 2 << 20, 5 * 60 * 200, 200);
     iSetTimer(5, iTimer);
     iInitialize(1000, 600, "Bounce Classic");
     // iPlaySound("assets/sounds/game_audio.wav",true);
@@ -0,0 +1,224 @@
+//
+//  Asset packs: one file holding pre-decoded images, device-format PCM audio
+//  and levels. The pack is memory-mapped and its blobs are used in place, so
+//  nothing is decoded at startup and pages are only read when touched.
+//  Packs are built offline with tools/iPacker.cpp.
+//
+//  Layout:
+//      PackHeader
+//      blob, blob, ...          (each starting on a PACK_ALIGN boundary)
+//      PackEntry[entryCount]    (sorted by name, at header.indexOffset)
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define PACK_MAGIC "IGPK"
+#define PACK_VERSION 1
+#define PACK_ALIGN 64
+#define MAX_PACK_NAME 112
+#define MAX_ASSET_PACKS 4
+
+enum PackEntryType
+{
+    PACK_IMAGE, // params: width, height, channels (always 4, RGBA, bottom row first)
+    PACK_SOUND, // params: frequency, SDL audio format, channels
+    PACK_LEVEL  // params: rows, cols (row-major glyphs, short rows padded with '.')
+};
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t alignment;
+    uint64_t indexOffset;
+} PackHeader;
+
+typedef struct
+{
+    char name[MAX_PACK_NAME]; // normalized path, e.g. "assets/sounds/chime.wav"
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    int32_t params[4];
+} PackEntry;
+
+typedef struct
+{
+    const unsigned char *base;
+    size_t size;
+    const PackEntry *entries;
+    int entryCount;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} AssetPack;
+
+AssetPack iAssetPacks[MAX_ASSET_PACKS];
+int iAssetPackCount = 0;
+
+// Pack names use forward slashes and no leading "./"
+void iNormalizePackName(const char *path, char *name)
+{
+    while (path[0] == '.' && (path[1] == '/' || path[1] == '\\'))
+        path += 2;
+    int i = 0;
+    for (; path[i] && i < MAX_PACK_NAME - 1; i++)
+    {
+        name[i] = (path[i] == '\\') ? '/' : path[i];
+    }
+    name[i] = '\0';
+}
+
+void iUnmapPack(AssetPack *pack)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(pack->base);
+    CloseHandle(pack->mapping);
+    CloseHandle(pack->file);
+#else
+    munmap((void *)pack->base, pack->size);
+#endif
+}
+
+bool iOpenAssetPack(const char *filename)
+{
+    if (iAssetPackCount >= MAX_ASSET_PACKS)
+    {
+        printf("Error: Maximum number of asset packs reached.\n");
+        return false;
+    }
+
+    AssetPack pack;
+    memset(&pack, 0, sizeof(pack));
+#ifdef _WIN32
+    pack.file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pack.file == INVALID_HANDLE_VALUE)
+    {
+        printf("Failed to open asset pack: %s\n", filename);
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(pack.file, &size);
+    pack.size = (size_t)size.QuadPart;
+    pack.mapping = CreateFileMappingA(pack.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    pack.base = pack.mapping ? (const unsigned char *)MapViewOfFile(pack.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (pack.base == nullptr)
+    {
+        if (pack.mapping)
+            CloseHandle(pack.mapping);
+        CloseHandle(pack.file);
+        printf("Failed to map asset pack: %s\n", filename);
+        return false;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Failed to open asset pack: %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (base == MAP_FAILED)
+    {
+        printf("Failed to map asset pack: %s\n", filename);
+        return false;
+    }
+    pack.base = (const unsigned char *)base;
+    pack.size = st.st_size;
+#endif
+
+    const PackHeader *header = (const PackHeader *)pack.base;
+    if (pack.size < sizeof(PackHeader) || memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION ||
+        header->indexOffset > pack.size || (pack.size - header->indexOffset) / sizeof(PackEntry) < header->entryCount)
+    {
+        printf("Invalid asset pack: %s\n", filename);
+        iUnmapPack(&pack);
+        return false;
+    }
+    pack.entries = (const PackEntry *)(pack.base + header->indexOffset);
+    pack.entryCount = header->entryCount;
+
+    iAssetPacks[iAssetPackCount++] = pack;
+    return true;
+}
+
+void iCloseAssetPacks()
+{
+    for (int i = 0; i < iAssetPackCount; i++)
+    {
+        iUnmapPack(&iAssetPacks[i]);
+    }
+    iAssetPackCount = 0;
+}
+
+// Looks `path` up in the open packs (first opened wins). Returns nullptr if absent.
+const PackEntry *iFindPackEntry(const char *path, int type)
+{
+    if (iAssetPackCount == 0)
+        return nullptr;
+
+    char name[MAX_PACK_NAME];
+    iNormalizePackName(path, name);
+    for (int p = 0; p < iAssetPackCount; p++)
+    {
+        const AssetPack *pack = &iAssetPacks[p];
+        int lo = 0, hi = pack->entryCount - 1;
+        while (lo <= hi)
+        {
+            int mid = (lo + hi) / 2;
+            int cmp = strcmp(name, pack->entries[mid].name);
+            if (cmp == 0)
+            {
+                const PackEntry *entry = &pack->entries[mid];
+                if ((int)entry->type != type || entry->offset + entry->size > pack->size)
+                    break;
+                return entry;
+            }
+            if (cmp < 0)
+                hi = mid - 1;
+            else
+                lo = mid + 1;
+        }
+    }
+    return nullptr;
+}
+
+const void *iPackData(const PackEntry *entry)
+{
+    for (int p = 0; p < iAssetPackCount; p++)
+    {
+        const AssetPack *pack = &iAssetPacks[p];
+        if (entry >= pack->entries && entry < pack->entries + pack->entryCount)
+            return pack->base + entry->offset;
+    }
+    return nullptr;
+}
+
+// Returns the packed level grid for `path` (rows * cols glyphs, no line breaks)
+const char *iFindPackedLevel(const char *path, int *rows, int *cols)
+{
+    const PackEntry *entry = iFindPackEntry(path, PACK_LEVEL);
+    if (entry == nullptr)
+        return nullptr;
+    *rows = entry->params[0];
+    *cols = entry->params[1];
+    return (const char *)iPackData(entry);
+}
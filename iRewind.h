@@ -0,0 +1,361 @@
+//
+//  Rewind: a history of the state registered in a Snapshot (see
+//  iSnapshot.h), recorded once per tick, for rewinding gameplay or stepping
+//  back through it while debugging.
+//
+//  Every keyframeInterval ticks the whole state is stored. The ticks between
+//  store only what changed since the tick before: the XOR of the two states
+//  with the runs of unchanged (zero) bytes left out, so a tick in which a few
+//  variables move takes a few dozen bytes. Going back one tick XORs the last
+//  delta into the current state; going back further decodes from the nearest
+//  keyframe when that is shorter. The history lives in one buffer of a fixed
+//  size; when it is full the oldest keyframe and its deltas are dropped.
+//
+//  A frame is a list of (unchanged bytes, changed bytes) varint pairs, each
+//  followed by the changed bytes XOR the previous state. A keyframe is the
+//  same encoding against a state of zeros.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "iSnapshot.h"
+
+typedef struct
+{
+    size_t offset; // in the buffer
+    size_t size;
+    bool keyframe;
+} RewindFrame;
+
+typedef struct
+{
+    Snapshot *state; // the regions recorded
+    int keyframeInterval;
+
+    unsigned char *buffer; // encoded frames, the oldest at frames[firstFrame].offset
+    size_t capacity;
+    size_t head;         // where the next frame goes
+    RewindFrame *frames; // ring of maxFrames frames, oldest first
+    int maxFrames, firstFrame, frameCount;
+    int sinceKeyframe; // frames after the newest keyframe
+
+    size_t stateSize;       // bytes in the recorded state
+    unsigned char *latest;  // the state at the newest frame
+    unsigned char *current; // the state being recorded
+    unsigned char *encoded; // the frame being encoded
+} Rewind;
+
+inline RewindFrame *iRewindFrame(const Rewind *rewind, int i)
+{
+    return &rewind->frames[(rewind->firstFrame + i) % rewind->maxFrames];
+}
+
+// Byte i of a XOR b, b being all zeros when it is nullptr
+inline unsigned char iRewindXor(const unsigned char *a, const unsigned char *b, size_t i)
+{
+    return b ? a[i] ^ b[i] : a[i];
+}
+
+inline bool iRewindWordChanged(const unsigned char *a, const unsigned char *b, size_t i)
+{
+    uint64_t x, y = 0;
+    memcpy(&x, a + i, 8);
+    if (b)
+        memcpy(&y, b + i, 8);
+    return x != y;
+}
+
+inline unsigned char *iPutRewindVarint(unsigned char *p, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+inline const unsigned char *iGetRewindVarint(const unsigned char *p, size_t *value)
+{
+    size_t v = 0;
+    int shift = 0;
+    while (*p & 0x80)
+    {
+        v |= (size_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = v | (size_t)*p++ << shift;
+    return p;
+}
+
+// Encodes `state` XOR `base` (the state itself if base is nullptr) into
+// `out`, which must hold iMaxRewindFrameSize(size) bytes. Returns the bytes
+// written. A run of changed bytes only ends at four or more unchanged bytes.
+size_t iEncodeRewindFrame(const unsigned char *state, const unsigned char *base, size_t size, unsigned char *out)
+{
+    unsigned char *p = out;
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t start = i;
+        while (i + 8 <= size && !iRewindWordChanged(state, base, i))
+            i += 8;
+        while (i < size && iRewindXor(state, base, i) == 0)
+            i++;
+        if (i == size)
+            break; // the rest is unchanged
+
+        size_t changed = i;
+        while (i < size)
+        {
+            if (iRewindXor(state, base, i) != 0)
+            {
+                i++;
+                continue;
+            }
+            size_t run = i;
+            while (run < size && run - i < 4 && iRewindXor(state, base, run) == 0)
+                run++;
+            if (run - i >= 4 || run == size)
+                break;
+            i = run;
+        }
+
+        p = iPutRewindVarint(p, changed - start);
+        p = iPutRewindVarint(p, i - changed);
+        for (size_t k = changed; k < i; k++)
+            *p++ = iRewindXor(state, base, k);
+    }
+    return p - out;
+}
+
+// Every run but the first starts with four unchanged bytes, and two varints take at most 20 bytes
+inline size_t iMaxRewindFrameSize(size_t stateSize)
+{
+    return stateSize + (stateSize / 4 + 1) * 20;
+}
+
+// XORs an encoded frame into `state`
+void iApplyRewindFrame(unsigned char *state, const unsigned char *frame, size_t size)
+{
+    const unsigned char *p = frame, *end = frame + size;
+    unsigned char *out = state;
+    while (p < end)
+    {
+        size_t unchanged, changed;
+        p = iGetRewindVarint(p, &unchanged);
+        p = iGetRewindVarint(p, &changed);
+        out += unchanged;
+        for (size_t k = 0; k < changed; k++)
+            out[k] ^= p[k];
+        out += changed;
+        p += changed;
+    }
+}
+
+// Forgets the history; the next frame recorded is a keyframe
+void iClearRewind(Rewind *rewind)
+{
+    rewind->head = 0;
+    rewind->firstFrame = 0;
+    rewind->frameCount = 0;
+    rewind->sinceKeyframe = 0;
+}
+
+// Keeps at most `budget` bytes of encoded frames and `maxFrames` frames, with
+// a keyframe every `keyframeInterval` frames. `state` is read on every
+// iRecordRewindFrame(), so regions may be registered after this call.
+bool iInitRewind(Rewind *rewind, Snapshot *state, size_t budget, int maxFrames, int keyframeInterval = 300)
+{
+    memset(rewind, 0, sizeof(Rewind));
+    rewind->state = state;
+    rewind->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    rewind->maxFrames = maxFrames > 1 ? maxFrames : 2;
+    rewind->capacity = budget;
+    rewind->buffer = (unsigned char *)malloc(budget > 0 ? budget : 1);
+    rewind->frames = (RewindFrame *)malloc(sizeof(RewindFrame) * rewind->maxFrames);
+    if (rewind->buffer == nullptr || rewind->frames == nullptr)
+    {
+        printf("Failed to allocate %zu bytes of rewind history\n", budget);
+        free(rewind->buffer);
+        free(rewind->frames);
+        rewind->buffer = nullptr;
+        rewind->frames = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void iFreeRewind(Rewind *rewind)
+{
+    free(rewind->buffer);
+    free(rewind->frames);
+    free(rewind->latest);
+    free(rewind->current);
+    free(rewind->encoded);
+    memset(rewind, 0, sizeof(Rewind));
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+void iDropOldestRewindGroup(Rewind *rewind)
+{
+    do
+    {
+        rewind->firstFrame = (rewind->firstFrame + 1) % rewind->maxFrames;
+        rewind->frameCount--;
+    } while (rewind->frameCount > 0 && !iRewindFrame(rewind, 0)->keyframe);
+    if (rewind->frameCount == 0)
+        iClearRewind(rewind);
+}
+
+// Finds `size` free bytes after the newest frame. The frames form one
+// circular run from the oldest to head; a frame that does not fit before
+// the end of the buffer starts again at 0.
+bool iFindRewindSpace(const Rewind *rewind, size_t size, size_t *offset)
+{
+    if (rewind->frameCount == 0)
+    {
+        *offset = 0;
+        return size <= rewind->capacity;
+    }
+    size_t tail = iRewindFrame(rewind, 0)->offset;
+    if (rewind->head >= tail)
+    {
+        if (rewind->capacity - rewind->head >= size)
+        {
+            *offset = rewind->head;
+            return true;
+        }
+        *offset = 0;
+        return size < tail; // head must not catch up with the oldest frame
+    }
+    *offset = rewind->head;
+    return tail - rewind->head > size;
+}
+
+// (Re)allocates the state buffers when the registered regions change size.
+// The old history no longer matches the state, so it is dropped.
+bool iResizeRewindState(Rewind *rewind, size_t size)
+{
+    free(rewind->latest);
+    free(rewind->current);
+    free(rewind->encoded);
+    rewind->latest = (unsigned char *)malloc(size > 0 ? size : 1);
+    rewind->current = (unsigned char *)malloc(size > 0 ? size : 1);
+    rewind->encoded = (unsigned char *)malloc(iMaxRewindFrameSize(size));
+    iClearRewind(rewind);
+    if (rewind->latest == nullptr || rewind->current == nullptr || rewind->encoded == nullptr)
+    {
+        printf("Failed to allocate %zu bytes of rewind state\n", size);
+        rewind->stateSize = 0;
+        return false;
+    }
+    rewind->stateSize = size;
+    return true;
+}
+
+// Call once per tick, after the state has been updated
+bool iRecordRewindFrame(Rewind *rewind)
+{
+    if (rewind->buffer == nullptr)
+        return false;
+    if (rewind->latest == nullptr || rewind->state->size != rewind->stateSize)
+    {
+        if (!iResizeRewindState(rewind, rewind->state->size))
+            return false;
+    }
+    iCopySnapshotRegions(rewind->state, rewind->current);
+
+    bool keyframe = rewind->frameCount == 0 || rewind->sinceKeyframe + 1 >= rewind->keyframeInterval;
+    size_t size = iEncodeRewindFrame(rewind->current, keyframe ? nullptr : rewind->latest, rewind->stateSize, rewind->encoded);
+    size_t offset;
+    while (rewind->frameCount == rewind->maxFrames || !iFindRewindSpace(rewind, size, &offset))
+    {
+        if (rewind->frameCount == 0)
+        {
+            printf("Error: A %zu byte rewind frame does not fit in the history.\n", size);
+            return false;
+        }
+        iDropOldestRewindGroup(rewind);
+        if (rewind->frameCount == 0 && !keyframe)
+        {
+            // The frame was a delta against the history just dropped
+            keyframe = true;
+            size = iEncodeRewindFrame(rewind->current, nullptr, rewind->stateSize, rewind->encoded);
+        }
+    }
+
+    memcpy(rewind->buffer + offset, rewind->encoded, size);
+    RewindFrame *frame = iRewindFrame(rewind, rewind->frameCount);
+    frame->offset = offset;
+    frame->size = size;
+    frame->keyframe = keyframe;
+    rewind->frameCount++;
+    rewind->head = offset + size;
+    rewind->sinceKeyframe = keyframe ? 0 : rewind->sinceKeyframe + 1;
+
+    unsigned char *latest = rewind->latest;
+    rewind->latest = rewind->current;
+    rewind->current = latest;
+    return true;
+}
+
+// Goes back `ticks` frames: the registered state becomes what it was that
+// many frames before the newest one, and the newer frames are dropped so
+// recording carries on from there. Returns how many frames it went back,
+// which is less than `ticks` when the history is shorter.
+int iRewind(Rewind *rewind, int ticks)
+{
+    if (ticks > rewind->frameCount - 1)
+        ticks = rewind->frameCount - 1;
+    if (ticks <= 0)
+        return 0;
+    int newest = rewind->frameCount - 1;
+    int target = newest - ticks;
+    int key = target;
+    while (!iRewindFrame(rewind, key)->keyframe)
+        key--;
+
+    // Backwards from the newest frame, unless a keyframe is in the way or
+    // forwards from the keyframe before the target is shorter
+    if (rewind->sinceKeyframe < ticks || target - key < ticks)
+    {
+        const RewindFrame *frame = iRewindFrame(rewind, key);
+        memset(rewind->latest, 0, rewind->stateSize);
+        iApplyRewindFrame(rewind->latest, rewind->buffer + frame->offset, frame->size);
+        for (int i = key + 1; i <= target; i++)
+        {
+            frame = iRewindFrame(rewind, i);
+            iApplyRewindFrame(rewind->latest, rewind->buffer + frame->offset, frame->size);
+        }
+    }
+    else
+    {
+        for (int i = newest; i > target; i--)
+        {
+            const RewindFrame *frame = iRewindFrame(rewind, i);
+            iApplyRewindFrame(rewind->latest, rewind->buffer + frame->offset, frame->size);
+        }
+    }
+
+    const RewindFrame *last = iRewindFrame(rewind, target);
+    rewind->frameCount = target + 1;
+    rewind->head = last->offset + last->size;
+    rewind->sinceKeyframe = target - key;
+    iPasteSnapshotRegions(rewind->state, rewind->latest);
+    return ticks;
+}
+
+// Bytes of the history buffer in use, counting the gap left at its end when the frames wrapped
+size_t iRewindBytesUsed(const Rewind *rewind)
+{
+    if (rewind->frameCount == 0)
+        return 0;
+    size_t tail = iRewindFrame(rewind, 0)->offset;
+    return rewind->head >= tail ? rewind->head - tail : rewind->capacity - tail + rewind->head;
+}
@@ -0,0 +1,127 @@
+//
+//  Snapshots: copies of chosen memory regions (globals, struct fields, heap
+//  buffers) that are taken and put back with plain memcpy, e.g. to restart a
+//  level from the state it started in without loading it again.
+//
+//  Register every region that makes up the state once, then take the
+//  snapshot. All regions are copied into one buffer, so restoring is a
+//  handful of memcpy calls however many variables are registered. Regions
+//  must hold plain data and stay valid (not be freed or moved) for as long
+//  as the snapshot is used; pointers inside them are copied as they are.
+//
+//      Snapshot start;
+//      iAddSnapshotVariable(&start, ballX);
+//      iAddSnapshotRegion(&start, map, rows * cols);
+//      iTakeSnapshot(&start);
+//      ...
+//      iRestoreSnapshot(&start);
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SNAPSHOT_REGIONS 64
+
+typedef struct
+{
+    void *address;
+    size_t size;
+} SnapshotRegion;
+
+typedef struct
+{
+    SnapshotRegion regions[MAX_SNAPSHOT_REGIONS];
+    int regionCount;
+    unsigned char *data; // the regions one after another
+    size_t size;         // bytes in all regions
+    size_t capacity;     // bytes allocated for data
+    bool taken;
+} Snapshot;
+
+// Adds `size` bytes at `address` to the state the snapshot covers. Any
+// snapshot taken before is dropped, as it no longer matches the regions.
+bool iAddSnapshotRegion(Snapshot *snapshot, void *address, size_t size)
+{
+    if (snapshot->regionCount >= MAX_SNAPSHOT_REGIONS)
+    {
+        printf("Error: Maximum number of snapshot regions reached.\n");
+        return false;
+    }
+    snapshot->regions[snapshot->regionCount].address = address;
+    snapshot->regions[snapshot->regionCount].size = size;
+    snapshot->regionCount++;
+    snapshot->size += size;
+    snapshot->taken = false;
+    return true;
+}
+
+// e.g. iAddSnapshotVariable(&start, enemy) for a global or a struct field
+#define iAddSnapshotVariable(snapshot, variable) iAddSnapshotRegion((snapshot), &(variable), sizeof(variable))
+
+// Forgets the regions (e.g. before registering the buffers of a new level).
+// The buffer is kept for the next snapshot.
+void iClearSnapshotRegions(Snapshot *snapshot)
+{
+    snapshot->regionCount = 0;
+    snapshot->size = 0;
+    snapshot->taken = false;
+}
+
+// Copies the regions, in order, into `out` (snapshot->size bytes)
+void iCopySnapshotRegions(const Snapshot *snapshot, unsigned char *out)
+{
+    for (int i = 0; i < snapshot->regionCount; i++)
+    {
+        memcpy(out, snapshot->regions[i].address, snapshot->regions[i].size);
+        out += snapshot->regions[i].size;
+    }
+}
+
+// Copies `in` (snapshot->size bytes, as written by iCopySnapshotRegions) back into the regions
+void iPasteSnapshotRegions(const Snapshot *snapshot, const unsigned char *in)
+{
+    for (int i = 0; i < snapshot->regionCount; i++)
+    {
+        memcpy(snapshot->regions[i].address, in, snapshot->regions[i].size);
+        in += snapshot->regions[i].size;
+    }
+}
+
+// Saves the current contents of the regions, replacing the last snapshot
+bool iTakeSnapshot(Snapshot *snapshot)
+{
+    if (snapshot->data == nullptr || snapshot->capacity < snapshot->size)
+    {
+        unsigned char *data = (unsigned char *)malloc(snapshot->size > 0 ? snapshot->size : 1);
+        if (data == nullptr)
+        {
+            printf("Failed to allocate %zu bytes for a snapshot\n", snapshot->size);
+            return false;
+        }
+        free(snapshot->data);
+        snapshot->data = data;
+        snapshot->capacity = snapshot->size;
+    }
+    iCopySnapshotRegions(snapshot, snapshot->data);
+    snapshot->taken = true;
+    return true;
+}
+
+// Puts the regions back as they were when the snapshot was taken.
+// Returns false if there is no snapshot.
+bool iRestoreSnapshot(const Snapshot *snapshot)
+{
+    if (!snapshot->taken)
+        return false;
+    iPasteSnapshotRegions(snapshot, snapshot->data);
+    return true;
+}
+
+void iFreeSnapshot(Snapshot *snapshot)
+{
+    free(snapshot->data);
+    memset(snapshot, 0, sizeof(Snapshot));
+}
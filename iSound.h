@@ -8,6 +8,7 @@
 #include <SDL.h>
 #include <SDL_mixer.h>
 #include <stdio.h>
+#include "iPack.h"
 using namespace std;
 
 Mix_Chunk *channelChunks[8];
@@ -79,9 +80,29 @@ void iStopAllSounds()
     }
 }
 
+// Returns a chunk that plays the PCM in an open asset pack without copying it,
+// or nullptr if the pack does not hold `filename` in the device's format.
+Mix_Chunk *iLoadPackedSound(const char *filename)
+{
+    const PackEntry *entry = iFindPackEntry(filename, PACK_SOUND);
+    if (entry == nullptr)
+        return nullptr;
+
+    int frequency, channels;
+    Uint16 format;
+    if (!Mix_QuerySpec(&frequency, &format, &channels) ||
+        entry->params[0] != frequency || entry->params[1] != format || entry->params[2] != channels)
+        return nullptr;
+
+    // SDL_mixer only reads the buffer and does not free it for QuickLoad chunks
+    return Mix_QuickLoad_RAW((Uint8 *)iPackData(entry), (Uint32)entry->size);
+}
+
 int iPlaySound(const char *filename, bool loop = false, int volume = 100) // If loop==true , then the audio will play again and again
 {
-    Mix_Chunk *sound = Mix_LoadWAV(filename);
+    Mix_Chunk *sound = iLoadPackedSound(filename);
+    if (!sound)
+        sound = Mix_LoadWAV(filename);
     if (!sound)
     {
         printf("Failed to load sound: %s\n", Mix_GetError());
@@ -0,0 +1,911 @@
+//
+//  Tile maps: collision queries on a grid of level glyphs ('#' = block), the
+//  solid tiles merged into a few rectangles, an index of the collectibles in
+//  a level, a distance field of the solid tiles and bitboards for raycasts
+//  and line of sight. Queries only look at the few cells or buckets they
+//  overlap, so their cost does not depend on the size of the map.
+//
+//  Row 0 is the top row of the level, the way level files are written.
+//  Row i covers screen y from topY - (i + 1) * tileHeight to
+//  topY - i * tileHeight.
+//  Column j covers screen x from j * tileWidth to (j + 1) * tileWidth. A grid
+//  may hold only columns firstCol..firstCol + cols - 1 of a level (e.g. the
+//  part of a streamed level that is loaded); columns are still numbered from
+//  the start of the level.
+//
+
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    const char *cells; // row-major glyphs, cells[0] is column firstCol of row 0
+    int stride;        // chars from one row to the next
+    int rows, cols;
+    int firstCol; // level column of the first column in cells, 0 unless set
+    int tileWidth, tileHeight;
+    int topY; // screen y of the top edge of row 0
+} TileGrid;
+
+// A view over existing glyphs, e.g. iInitTileGrid(&tiles, &map[0][0], MAX_COLS, mapRows, mapCols, 50, 50, screenHeight)
+void iInitTileGrid(TileGrid *grid, const char *cells, int stride, int rows, int cols, int tileWidth, int tileHeight, int topY)
+{
+    grid->cells = cells;
+    grid->stride = stride;
+    grid->rows = rows;
+    grid->cols = cols;
+    grid->tileWidth = tileWidth;
+    grid->tileHeight = tileHeight;
+    grid->topY = topY;
+    grid->firstCol = 0;
+}
+
+// Glyph at (row, col), or '\0' outside the grid
+inline char iGetTile(const TileGrid *grid, int row, int col)
+{
+    col -= grid->firstCol;
+    if (row < 0 || row >= grid->rows || col < 0 || col >= grid->cols)
+        return '\0';
+    return grid->cells[(size_t)row * grid->stride + col];
+}
+
+inline float iTileX(const TileGrid *grid, int col)
+{
+    return (float)col * grid->tileWidth;
+}
+
+// Screen y of the bottom edge of a row
+inline float iTileY(const TileGrid *grid, int row)
+{
+    return (float)(grid->topY - (row + 1) * grid->tileHeight);
+}
+
+// Cells overlapped by the rectangle (x, y, width, height), clamped to the grid.
+// Touching edges do not count as overlapping. Returns false if no cell is overlapped.
+bool iGetTileRange(const TileGrid *grid, float x, float y, float width, float height,
+                   int *row0, int *col0, int *row1, int *col1)
+{
+    *col0 = (int)floorf(x / grid->tileWidth);
+    *col1 = (int)ceilf((x + width) / grid->tileWidth) - 1;
+    *row0 = (int)floorf((grid->topY - y - height) / grid->tileHeight);
+    *row1 = (int)ceilf((grid->topY - y) / grid->tileHeight) - 1;
+    if (*col0 < grid->firstCol)
+        *col0 = grid->firstCol;
+    if (*row0 < 0)
+        *row0 = 0;
+    if (*col1 >= grid->firstCol + grid->cols)
+        *col1 = grid->firstCol + grid->cols - 1;
+    if (*row1 >= grid->rows)
+        *row1 = grid->rows - 1;
+    return *col0 <= *col1 && *row0 <= *row1;
+}
+
+// True if the rectangle overlaps any cell holding `solid`
+bool iRectHitsTiles(const TileGrid *grid, float x, float y, float width, float height, char solid = '#')
+{
+    int row0, col0, row1, col1;
+    if (!iGetTileRange(grid, x, y, width, height, &row0, &col0, &row1, &col1))
+        return false;
+    for (int i = row0; i <= row1; i++)
+    {
+        const char *row = grid->cells + (size_t)i * grid->stride;
+        for (int j = col0 - grid->firstCol; j <= col1 - grid->firstCol; j++)
+        {
+            if (row[j] == solid)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Solid tiles row..row + rows - 1, col..col + cols - 1 (level columns)
+typedef struct
+{
+    int32_t row, col;
+    int32_t rows, cols;
+} TileRect;
+
+// Merges the `solid` cells of the grid into rectangles, greedily: take the
+// first unmerged solid cell in row-major order, grow it right as far as the
+// row allows, then down while the whole span is solid. A level usually needs
+// more than ten times fewer rectangles than it has solid tiles. Returns the
+// number of rectangles; at most maxRects are written to rects.
+int iMergeSolidTiles(const TileGrid *grid, TileRect *rects, int maxRects, char solid = '#')
+{
+    int rows = grid->rows, cols = grid->cols;
+    unsigned char *merged = (unsigned char *)calloc((size_t)rows * cols > 0 ? (size_t)rows * cols : 1, 1);
+    if (merged == nullptr)
+    {
+        printf("Error: Out of memory merging solid tiles.\n");
+        return 0;
+    }
+    int count = 0;
+    for (int row = 0; row < rows; row++)
+    {
+        const char *cells = grid->cells + (size_t)row * grid->stride;
+        for (int col = 0; col < cols; col++)
+        {
+            size_t i = (size_t)row * cols + col;
+            if (cells[col] != solid || merged[i])
+                continue;
+
+            int width = 1;
+            while (col + width < cols && cells[col + width] == solid && !merged[i + width])
+                width++;
+
+            int height = 1;
+            for (; row + height < rows; height++)
+            {
+                const char *below = cells + (size_t)height * grid->stride;
+                size_t belowMerged = i + (size_t)height * cols;
+                int k = 0;
+                while (k < width && below[col + k] == solid && !merged[belowMerged + k])
+                    k++;
+                if (k < width)
+                    break;
+            }
+
+            for (int r = 0; r < height; r++)
+                memset(&merged[i + (size_t)r * cols], 1, width);
+            if (count < maxRects)
+                rects[count] = {row, grid->firstCol + col, height, width};
+            count++;
+        }
+    }
+    free(merged);
+    return count;
+}
+
+// True if the circle overlaps any of the rectangles, placed on the grid's tiles
+bool iCircleHitsTileRects(const TileGrid *grid, const TileRect *rects, int count, float x, float y, float radius)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float left = (float)rects[i].col * grid->tileWidth;
+        float right = left + (float)rects[i].cols * grid->tileWidth;
+        float top = grid->topY - (float)rects[i].row * grid->tileHeight;
+        float bottom = top - (float)rects[i].rows * grid->tileHeight;
+        // Distance from the centre to the nearest point of the rectangle
+        float dx = x - fminf(fmaxf(x, left), right);
+        float dy = y - fminf(fmaxf(y, bottom), top);
+        if (dx * dx + dy * dy < radius * radius)
+            return true;
+    }
+    return false;
+}
+
+// Collectibles: items are kept in one array grouped by column bucket, so a
+// pickup test only looks at the buckets within reach, and a collected item is
+// removed by moving the last item of its bucket into its slot. The arrays are
+// sized when the index is built and reused by later builds.
+#define MAX_COLLECTIBLE_BUCKETS (1 << 20) // for iBuildCollectibleIndex()
+typedef struct
+{
+    float x, y;   // centre
+    int id;       // free for the caller
+    int row, col; // tile it came from, -1 if not from a tile grid
+} Collectible;
+
+typedef struct
+{
+    Collectible *items; // grouped by bucket
+    int *bucketStart;
+    int *bucketCount;   // items left in each bucket
+    int count;          // items left in total
+    int buckets;
+    int capacity;       // items allocated
+    int bucketCapacity; // buckets allocated (bucketStart and bucketCount share one block)
+    float bucketWidth;
+    float originX; // left edge of bucket 0
+} CollectibleIndex;
+
+inline int iCollectibleBucket(const CollectibleIndex *index, float x)
+{
+    int bucket = (int)floorf((x - index->originX) / index->bucketWidth);
+    if (bucket < 0)
+        return 0;
+    return (bucket < index->buckets) ? bucket : index->buckets - 1;
+}
+
+// Makes room for `items` items in `buckets` empty buckets. On failure the index is left empty.
+bool iReserveCollectibles(CollectibleIndex *index, int items, int buckets)
+{
+    index->count = 0;
+    index->buckets = 0;
+    if (index->items == nullptr || index->capacity < items)
+    {
+        free(index->items);
+        index->items = (Collectible *)malloc(sizeof(Collectible) * (items > 0 ? items : 1));
+        index->capacity = index->items ? items : 0;
+    }
+    if (index->bucketStart == nullptr || index->bucketCapacity < buckets)
+    {
+        free(index->bucketStart);
+        index->bucketStart = (int *)malloc(sizeof(int) * 2 * buckets);
+        index->bucketCapacity = index->bucketStart ? buckets : 0;
+    }
+    if (index->items == nullptr || index->bucketStart == nullptr)
+    {
+        printf("Error: Out of memory for %d collectibles.\n", items);
+        return false;
+    }
+    index->bucketCount = index->bucketStart + index->bucketCapacity;
+    memset(index->bucketCount, 0, sizeof(int) * buckets);
+    index->buckets = buckets;
+    return true;
+}
+
+void iFreeCollectibleIndex(CollectibleIndex *index)
+{
+    free(index->items);
+    free(index->bucketStart);
+    memset(index, 0, sizeof(*index));
+}
+
+// Indexes `count` items, `bucketWidth` pixels per bucket. Returns false if out of memory.
+bool iBuildCollectibleIndex(CollectibleIndex *index, const Collectible *items, int count, float bucketWidth)
+{
+    index->bucketWidth = (bucketWidth > 0) ? bucketWidth : 1;
+    float minX = 0, maxX = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (i == 0 || items[i].x < minX)
+            minX = items[i].x;
+        if (i == 0 || items[i].x > maxX)
+            maxX = items[i].x;
+    }
+    index->originX = minX;
+    // Items spread very far apart get wider buckets rather than a huge bucket table
+    if ((maxX - minX) / index->bucketWidth > MAX_COLLECTIBLE_BUCKETS)
+        index->bucketWidth = (maxX - minX) / MAX_COLLECTIBLE_BUCKETS;
+    if (!iReserveCollectibles(index, count, (int)floorf((maxX - minX) / index->bucketWidth) + 1))
+        return false;
+    index->count = count;
+    for (int i = 0; i < count; i++)
+    {
+        index->bucketCount[iCollectibleBucket(index, items[i].x)]++;
+    }
+    int start = 0;
+    for (int b = 0; b < index->buckets; b++)
+    {
+        index->bucketStart[b] = start;
+        start += index->bucketCount[b];
+        index->bucketCount[b] = 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int b = iCollectibleBucket(index, items[i].x);
+        index->items[index->bucketStart[b] + index->bucketCount[b]++] = items[i];
+    }
+    return true;
+}
+
+// Indexes every tile holding `glyph`, one bucket per column of tiles.
+// Returns the number of items found, or -1 if out of memory.
+int iBuildCollectiblesFromTiles(CollectibleIndex *index, const TileGrid *grid, char glyph)
+{
+    int found = 0;
+    for (int i = 0; i < grid->rows; i++)
+    {
+        const char *row = grid->cells + (size_t)i * grid->stride;
+        for (int j = 0; j < grid->cols; j++)
+            found += (row[j] == glyph);
+    }
+    index->bucketWidth = (float)grid->tileWidth;
+    index->originX = iTileX(grid, grid->firstCol);
+    if (!iReserveCollectibles(index, found, grid->cols > 0 ? grid->cols : 1))
+        return -1;
+    // Walking column by column fills the buckets in order
+    for (int j = 0; j < grid->cols; j++)
+    {
+        index->bucketStart[j] = index->count;
+        for (int i = 0; i < grid->rows; i++)
+        {
+            if (grid->cells[(size_t)i * grid->stride + j] != glyph)
+                continue;
+            Collectible *item = &index->items[index->count++];
+            item->x = iTileX(grid, grid->firstCol + j) + grid->tileWidth / 2.0f;
+            item->y = iTileY(grid, i) + grid->tileHeight / 2.0f;
+            item->id = index->count - 1;
+            item->row = i;
+            item->col = grid->firstCol + j;
+            index->bucketCount[j]++;
+        }
+    }
+    if (grid->cols <= 0)
+        index->bucketStart[0] = 0;
+    return index->count;
+}
+
+// Removes the items whose centre is closer than `reach` to (x, y) and copies
+// them to `collected` (at most maxCollected per call). Returns how many were collected.
+int iCollectNear(CollectibleIndex *index, float x, float y, float reach, Collectible *collected, int maxCollected)
+{
+    int found = 0;
+    if (index->buckets == 0)
+        return 0;
+    int first = iCollectibleBucket(index, x - reach);
+    int last = iCollectibleBucket(index, x + reach);
+    for (int b = first; b <= last && found < maxCollected; b++)
+    {
+        Collectible *bucket = index->items + index->bucketStart[b];
+        for (int k = 0; k < index->bucketCount[b] && found < maxCollected; k++)
+        {
+            float dx = bucket[k].x - x;
+            float dy = bucket[k].y - y;
+            if (dx * dx + dy * dy >= reach * reach)
+                continue;
+            collected[found++] = bucket[k];
+            bucket[k] = bucket[--index->bucketCount[b]];
+            index->count--;
+            k--; // the moved item has not been tested yet
+        }
+    }
+    return found;
+}
+
+// Signed distance field of the solid tiles, sampled `samplesPerTile` times
+// across a tile. Built once per level in linear time with the Euclidean
+// distance transform of Felzenszwalb and Huttenlocher; a query looks at the
+// few samples around the point and never returns more than the true distance.
+// The field covers the map plus one empty tile all around it.
+typedef struct
+{
+    float *distance; // pixels to the nearest solid edge, negative inside solids; row 0 at the bottom
+    int width, height;      // samples
+    int capacity;           // samples allocated
+    float cellSize;         // pixels between samples
+    float originX, originY; // screen position of the corner of sample (0, 0)
+} DistanceField;
+
+#define DISTANCE_FIELD_INF 1e20
+
+// Squared distance transform of one line (f = 0 on features, INF elsewhere).
+// nearest[q] receives the position the distance of q was measured to.
+void iDistanceTransform1D(const double *f, double *d, int *nearest, int *v, double *z, int n)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -DISTANCE_FIELD_INF;
+    z[1] = DISTANCE_FIELD_INF;
+    for (int q = 1; q < n; q++)
+    {
+        double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        while (s <= z[k])
+        {
+            k--;
+            s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = DISTANCE_FIELD_INF;
+    }
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < q)
+            k++;
+        d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+        nearest[q] = v[k];
+    }
+}
+
+// For every sample, the nearest sample (by centre) where grid[i] == target,
+// as an index into grid, or -1 if there is none. Returns false if out of memory.
+bool iNearestSamples(const bool *grid, bool target, int *out, int width, int height)
+{
+    int n = (width > height) ? width : height;
+    double *f = (double *)malloc(sizeof(double) * n);
+    double *d = (double *)malloc(sizeof(double) * n);
+    double *z = (double *)malloc(sizeof(double) * (n + 1));
+    int *v = (int *)malloc(sizeof(int) * n);
+    int *nearest = (int *)malloc(sizeof(int) * n);
+    double *columnDistance = (double *)malloc(sizeof(double) * width * height);
+    int *columnNearest = (int *)malloc(sizeof(int) * width * height); // nearest row in the same column
+    bool ok = f && d && z && v && nearest && columnDistance && columnNearest;
+
+    for (int x = 0; ok && x < width; x++)
+    {
+        for (int y = 0; y < height; y++)
+            f[y] = (grid[y * width + x] == target) ? 0 : DISTANCE_FIELD_INF;
+        iDistanceTransform1D(f, d, nearest, v, z, height);
+        for (int y = 0; y < height; y++)
+        {
+            columnDistance[y * width + x] = d[y];
+            columnNearest[y * width + x] = nearest[y];
+        }
+    }
+    for (int y = 0; ok && y < height; y++)
+    {
+        iDistanceTransform1D(columnDistance + y * width, d, nearest, v, z, width);
+        for (int x = 0; x < width; x++)
+        {
+            int nx = nearest[x];
+            out[y * width + x] = (d[x] >= DISTANCE_FIELD_INF) ? -1 : columnNearest[y * width + nx] * width + nx;
+        }
+    }
+
+    free(f);
+    free(d);
+    free(z);
+    free(v);
+    free(nearest);
+    free(columnDistance);
+    free(columnNearest);
+    return ok;
+}
+
+// Builds (or rebuilds, reusing memory) the field of the tiles holding `solid`
+bool iBuildDistanceField(DistanceField *field, const TileGrid *grid, char solid = '#', int samplesPerTile = 4)
+{
+    if (samplesPerTile < 1)
+        samplesPerTile = 1;
+    float cellSize = (float)grid->tileWidth / samplesPerTile;
+    int width = (grid->cols + 2) * samplesPerTile;
+    int height = (int)ceilf((grid->rows + 2) * grid->tileHeight / cellSize);
+    int samples = width * height;
+
+    if (field->distance == nullptr || field->capacity < samples)
+    {
+        free(field->distance);
+        field->distance = (float *)malloc(sizeof(float) * samples);
+        field->capacity = field->distance ? samples : 0;
+        if (field->distance == nullptr)
+        {
+            printf("Error: Out of memory for the distance field.\n");
+            return false;
+        }
+    }
+    field->width = width;
+    field->height = height;
+    field->cellSize = cellSize;
+    field->originX = iTileX(grid, grid->firstCol - 1);
+    field->originY = (float)(grid->topY - (grid->rows + 1) * grid->tileHeight);
+
+    bool *solidAt = (bool *)malloc(sizeof(bool) * samples);
+    int *nearestSolid = (int *)malloc(sizeof(int) * samples);
+    int *nearestEmpty = (int *)malloc(sizeof(int) * samples);
+    for (int v = 0; solidAt != nullptr && v < height; v++)
+    {
+        float y = field->originY + (v + 0.5f) * cellSize;
+        int row = (int)floorf((grid->topY - y) / grid->tileHeight);
+        for (int u = 0; u < width; u++)
+        {
+            float x = field->originX + (u + 0.5f) * cellSize;
+            int col = (int)floorf(x / grid->tileWidth);
+            solidAt[v * width + u] = iGetTile(grid, row, col) == solid;
+        }
+    }
+    if (solidAt == nullptr || nearestSolid == nullptr || nearestEmpty == nullptr ||
+        !iNearestSamples(solidAt, true, nearestSolid, width, height) ||
+        !iNearestSamples(solidAt, false, nearestEmpty, width, height))
+    {
+        printf("Error: Out of memory for the distance field.\n");
+        free(solidAt);
+        free(nearestSolid);
+        free(nearestEmpty);
+        return false;
+    }
+
+    // Each sample stands for a square of cellSize. The distance stored is the
+    // one from the sample centre to the square of the nearest opposite sample.
+    // Nearest by centre is also nearest by square up to 4.3 samples away;
+    // farther out the square found can be up to (sqrt(2) - 1) / 2 samples too
+    // far, so that much is taken off and a stored distance is never too large.
+    for (int v = 0; v < height; v++)
+    {
+        for (int u = 0; u < width; u++)
+        {
+            int i = v * width + u;
+            int other = solidAt[i] ? nearestEmpty[i] : nearestSolid[i];
+            if (other < 0)
+            {
+                field->distance[i] = solidAt[i] ? -1e9f : 1e9f;
+                continue;
+            }
+            float ax = fmaxf(fabsf((float)(other % width - u)) - 0.5f, 0.0f);
+            float ay = fmaxf(fabsf((float)(other / width - v)) - 0.5f, 0.0f);
+            float d = sqrtf(ax * ax + ay * ay);
+            if (d > 4.3f)
+                d -= 0.2072f;
+            d *= cellSize;
+            field->distance[i] = solidAt[i] ? -d : d;
+        }
+    }
+
+    free(solidAt);
+    free(nearestSolid);
+    free(nearestEmpty);
+    return true;
+}
+
+void iFreeDistanceField(DistanceField *field)
+{
+    free(field->distance);
+    field->distance = nullptr;
+    field->capacity = 0;
+}
+
+// Distance from (x, y) to the nearest solid edge, negative inside a solid tile
+float iSampleDistance(const DistanceField *field, float x, float y)
+{
+    // The four samples around (x, y), clamped to the field
+    float fx = (x - field->originX) / field->cellSize - 0.5f;
+    float fy = (y - field->originY) / field->cellSize - 0.5f;
+    float cx = fminf(fmaxf(fx, 0.0f), (float)(field->width - 1));
+    float cy = fminf(fmaxf(fy, 0.0f), (float)(field->height - 1));
+    int u = (int)cx, v = (int)cy;
+    if (u > field->width - 2)
+        u = field->width - 2;
+    if (v > field->height - 2)
+        v = field->height - 2;
+    float tx = cx - u, ty = cy - v;
+    const float *row0 = field->distance + v * field->width + u;
+    const float *row1 = row0 + field->width;
+
+    // Blending the samples would overestimate the distance near convex
+    // corners and let iAdvanceCircle() step into a wall. Instead the distance
+    // is measured to the sample squares around (x, y): solids are made of
+    // whole sample squares and the sign of a sample tells which ones. The four
+    // samples around (x, y) tell how far to look, at most 4 samples.
+    float px = cx + 0.5f, py = cy + 0.5f; // in samples from the field corner
+    bool inside = field->distance[(int)py * field->width + (int)px] < 0;
+    const float *corners[4] = {row0, row0 + 1, row1, row1 + 1};
+    float reach = 4;
+    for (int k = 0; k < 4; k++)
+    {
+        // Stored distances below 4.3 samples are exact (see iBuildDistanceField)
+        float far = hypotf(px - (u + 0.5f + (k & 1)), py - (v + 0.5f + (k >> 1)));
+        if ((*corners[k] < 0) == inside)
+            far += fabsf(*corners[k]) / field->cellSize;
+        reach = fminf(reach, far);
+    }
+    float closest = reach * reach; // squared, in samples
+    bool found = false;
+    for (int j = (int)floorf(py - reach); j <= (int)floorf(py + reach); j++)
+    {
+        for (int i = (int)floorf(px - reach); i <= (int)floorf(px + reach); i++)
+        {
+            // Beyond the field everything is empty
+            bool solid = i >= 0 && i < field->width && j >= 0 && j < field->height &&
+                         field->distance[j * field->width + i] < 0;
+            if (solid == inside)
+                continue;
+            float ax = fmaxf(fmaxf(i - px, px - (i + 1)), 0.0f);
+            float ay = fmaxf(fmaxf(j - py, py - (j + 1)), 0.0f);
+            if (ax * ax + ay * ay <= closest)
+            {
+                closest = ax * ax + ay * ay;
+                found = true;
+            }
+        }
+    }
+
+    float d;
+    if (found)
+    {
+        d = sqrtf(closest) * field->cellSize;
+        if (inside)
+            d = -d;
+    }
+    else
+    {
+        // Farther away than that, the larger of some lower bounds. The
+        // distance changes by at most a pixel per pixel, so a sample s gives
+        // d(s) - |p - s|. Outside the solids it is also at least `reach` and
+        // at least the smallest of the four samples.
+        float left = tx * field->cellSize, right = field->cellSize - left;
+        float below = ty * field->cellSize, above = field->cellSize - below;
+        d = fmaxf(fmaxf(row0[0] - hypotf(left, below), row0[1] - hypotf(right, below)),
+                  fmaxf(row1[0] - hypotf(left, above), row1[1] - hypotf(right, above)));
+        if (!inside)
+        {
+            float smallest = fminf(fminf(row0[0], row0[1]), fminf(row1[0], row1[1]));
+            d = fmaxf(d, fmaxf(smallest, reach * field->cellSize));
+        }
+    }
+
+    // Outside the field everything is empty, and the field is convex, so
+    // the nearest solid is at least this far away
+    float ex = (fx - cx) * field->cellSize, ey = (fy - cy) * field->cellSize;
+    if (ex != 0 || ey != 0)
+        d = sqrtf(d * d + ex * ex + ey * ey);
+    return d;
+}
+
+// Direction of increasing distance at (x, y), normalized. Away from the
+// nearest solid, so it is the contact normal for a circle touching a wall.
+void iSampleDistanceGradient(const DistanceField *field, float x, float y, float *gx, float *gy)
+{
+    float h = field->cellSize * 0.5f;
+    float dx = iSampleDistance(field, x + h, y) - iSampleDistance(field, x - h, y);
+    float dy = iSampleDistance(field, x, y + h) - iSampleDistance(field, x, y - h);
+    float length = sqrtf(dx * dx + dy * dy);
+    if (length > 0)
+    {
+        dx /= length;
+        dy /= length;
+    }
+    *gx = dx;
+    *gy = dy;
+}
+
+// Conservative advancement: moves a circle from (x, y) along (dx, dy) in
+// steps as long as the free distance around it, so it can never skip over a
+// wall. Stops when it touches a solid while moving into it. *time is the
+// fraction of the move that is free (0..1, less than 1 without a hit only if
+// the step budget ran out); on a hit the contact normal is returned.
+bool iAdvanceCircle(const DistanceField *field, float x, float y, float radius, float dx, float dy,
+                    float *time, float *normalX, float *normalY)
+{
+    const float contact = 0.05f; // pixels
+    float length = sqrtf(dx * dx + dy * dy);
+    float t = 0;
+    *time = 1;
+    if (length == 0)
+        return false;
+
+    for (int step = 0; step < 64 && t < 1; step++)
+    {
+        float px = x + dx * t, py = y + dy * t;
+        float gap = iSampleDistance(field, px, py) - radius;
+        if (gap <= contact)
+        {
+            float nx, ny;
+            iSampleDistanceGradient(field, px, py, &nx, &ny);
+            if (nx * dx + ny * dy < 0)
+            {
+                *time = t;
+                *normalX = nx;
+                *normalY = ny;
+                return true;
+            }
+            // Touching but moving away: leave the surface by a small step
+            gap = field->cellSize * 0.25f;
+        }
+        t += gap / length;
+    }
+    *time = (t < 1) ? t : 1;
+    return false;
+}
+
+// Solid tiles as one bit per tile, 64 columns per word, so runs of empty
+// tiles along a row are skipped a word at a time.
+typedef struct
+{
+    uint64_t *bits; // row-major, `words` words per row; column c is bit c % 64 of word c / 64
+    int rows, cols;
+    int firstCol; // level column of bit 0, as in the TileGrid it was built from
+    int words;    // words per row
+    int capacity; // words allocated
+    int tileWidth, tileHeight;
+    int topY;
+} TileBitboard;
+
+// Builds (or rebuilds, reusing memory) the bitboard of the tiles holding `solid`
+bool iBuildTileBitboard(TileBitboard *board, const TileGrid *grid, char solid = '#')
+{
+    int words = (grid->cols + 63) / 64;
+    int needed = words * grid->rows;
+    if (board->bits == nullptr || board->capacity < needed)
+    {
+        free(board->bits);
+        board->bits = (uint64_t *)malloc(sizeof(uint64_t) * (needed > 0 ? needed : 1));
+        board->capacity = board->bits ? needed : 0;
+        if (board->bits == nullptr)
+        {
+            printf("Error: Out of memory for the tile bitboard.\n");
+            return false;
+        }
+    }
+    board->rows = grid->rows;
+    board->cols = grid->cols;
+    board->firstCol = grid->firstCol;
+    board->words = words;
+    board->tileWidth = grid->tileWidth;
+    board->tileHeight = grid->tileHeight;
+    board->topY = grid->topY;
+    memset(board->bits, 0, sizeof(uint64_t) * needed);
+    for (int i = 0; i < grid->rows; i++)
+    {
+        const char *row = grid->cells + (size_t)i * grid->stride;
+        for (int j = 0; j < grid->cols; j++)
+        {
+            if (row[j] == solid)
+                board->bits[i * words + (j >> 6)] |= (uint64_t)1 << (j & 63);
+        }
+    }
+    return true;
+}
+
+void iFreeTileBitboard(TileBitboard *board)
+{
+    free(board->bits);
+    board->bits = nullptr;
+    board->capacity = 0;
+}
+
+inline bool iIsSolidTile(const TileBitboard *board, int row, int col)
+{
+    col -= board->firstCol;
+    if (row < 0 || row >= board->rows || col < 0 || col >= board->cols)
+        return false;
+    return (board->bits[row * board->words + (col >> 6)] >> (col & 63)) & 1;
+}
+
+// For tiles that change during play
+inline void iSetSolidTile(TileBitboard *board, int row, int col, bool solid)
+{
+    col -= board->firstCol;
+    if (row < 0 || row >= board->rows || col < 0 || col >= board->cols)
+        return;
+    uint64_t bit = (uint64_t)1 << (col & 63);
+    if (solid)
+        board->bits[row * board->words + (col >> 6)] |= bit;
+    else
+        board->bits[row * board->words + (col >> 6)] &= ~bit;
+}
+
+// First solid column of `row` walking from `from` towards `to` (either
+// direction, both inclusive), or -1 if that stretch is empty
+int iFindSolidInRow(const TileBitboard *board, int row, int from, int to)
+{
+    if (row < 0 || row >= board->rows)
+        return -1;
+    int lo = (from < to) ? from : to, hi = (from < to) ? to : from;
+    lo -= board->firstCol;
+    hi -= board->firstCol;
+    if (lo < 0)
+        lo = 0;
+    if (hi >= board->cols)
+        hi = board->cols - 1;
+    if (lo > hi)
+        return -1;
+
+    const uint64_t *bits = board->bits + row * board->words;
+    if (from <= to)
+    {
+        for (int w = lo >> 6; w <= hi >> 6; w++)
+        {
+            uint64_t word = bits[w];
+            if (w == lo >> 6)
+                word &= ~(uint64_t)0 << (lo & 63);
+            if (w == hi >> 6 && (hi & 63) != 63)
+                word &= ((uint64_t)1 << ((hi & 63) + 1)) - 1;
+            if (word)
+                return board->firstCol + w * 64 + __builtin_ctzll(word);
+        }
+    }
+    else
+    {
+        for (int w = hi >> 6; w >= lo >> 6; w--)
+        {
+            uint64_t word = bits[w];
+            if (w == lo >> 6)
+                word &= ~(uint64_t)0 << (lo & 63);
+            if (w == hi >> 6 && (hi & 63) != 63)
+                word &= ((uint64_t)1 << ((hi & 63) + 1)) - 1;
+            if (word)
+                return board->firstCol + w * 64 + 63 - __builtin_clzll(word);
+        }
+    }
+    return -1;
+}
+
+typedef struct
+{
+    float x, y;             // where the ray enters the solid tile
+    float distance;         // from the start of the ray, in pixels
+    float normalX, normalY; // side of the tile that was hit (0, 0 if the ray starts inside a solid)
+    int row, col;           // the tile
+} RayHit;
+
+// Casts a ray from (x0, y0) to (x1, y1) and finds the first solid tile on it.
+// The ray is walked one tile row at a time (a DDA over rows); within a row
+// the columns it crosses are searched in the bitboard a word at a time.
+bool iRaycastTiles(const TileBitboard *board, float x0, float y0, float x1, float y1, RayHit *hit)
+{
+    // Tile coordinates: column grows to the right, row grows downwards
+    float gx0 = x0 / board->tileWidth, gy0 = (board->topY - y0) / board->tileHeight;
+    float gx1 = x1 / board->tileWidth, gy1 = (board->topY - y1) / board->tileHeight;
+    float dx = gx1 - gx0, dy = gy1 - gy0;
+    // A ray starting or ending exactly on a tile edge only covers the tile it moves into
+    int stepRow = (dy > 0) ? 1 : -1;
+    int firstRow = (dy < 0) ? (int)ceilf(gy0) - 1 : (int)floorf(gy0);
+    int lastRow = firstRow;
+    if (dy > 0)
+        lastRow = (int)ceilf(gy1) - 1;
+    else if (dy < 0)
+        lastRow = (int)floorf(gy1);
+    if ((lastRow - firstRow) * stepRow < 0)
+        lastRow = firstRow;
+
+    for (int row = firstRow;; row += stepRow)
+    {
+        // Part of the ray inside this row
+        float tIn = 0, tOut = 1;
+        if (dy != 0)
+        {
+            float tA = (row - gy0) / dy, tB = (row + 1 - gy0) / dy;
+            tIn = fmaxf(fminf(tA, tB), 0.0f);
+            tOut = fminf(fmaxf(tA, tB), 1.0f);
+        }
+        if (row >= 0 && row < board->rows && tIn <= tOut)
+        {
+            float xIn = gx0 + dx * tIn, xOut = gx0 + dx * tOut;
+            int from = (dx < 0) ? (int)ceilf(xIn) - 1 : (int)floorf(xIn);
+            int to = from;
+            if (dx > 0)
+                to = (int)ceilf(xOut) - 1;
+            else if (dx < 0)
+                to = (int)floorf(xOut);
+            if ((to - from) * dx < 0)
+                to = from;
+
+            int col = iFindSolidInRow(board, row, from, to);
+            if (col >= 0)
+            {
+                // Entered through the side of the tile or through its top/bottom
+                float t = tIn;
+                float nx = 0, ny = 0;
+                if (col != from && dx != 0)
+                {
+                    float edge = (dx > 0) ? (float)col : (float)(col + 1);
+                    t = (edge - gx0) / dx;
+                    nx = (dx > 0) ? -1.0f : 1.0f;
+                }
+                else if (row != firstRow)
+                {
+                    ny = (dy > 0) ? 1.0f : -1.0f; // rows grow downwards, normals are in screen space
+                }
+                hit->x = x0 + (x1 - x0) * t;
+                hit->y = y0 + (y1 - y0) * t;
+                hit->distance = t * sqrtf((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+                hit->normalX = nx;
+                hit->normalY = ny;
+                hit->row = row;
+                hit->col = col;
+                return true;
+            }
+        }
+        if (row == lastRow)
+            break;
+    }
+    return false;
+}
+
+// True if no solid tile lies between (x0, y0) and (x1, y1)
+inline bool iHasLineOfSight(const TileBitboard *board, float x0, float y0, float x1, float y1)
+{
+    RayHit hit;
+    return !iRaycastTiles(board, x0, y0, x1, y1, &hit);
+}
+
+// Line of sight from one point to many (e.g. the player to every enemy).
+// visible[i] is set for each target; returns how many are visible.
+int iLineOfSightBatch(const TileBitboard *board, float fromX, float fromY,
+                      const float *toX, const float *toY, int count, bool *visible)
+{
+    int seen = 0;
+    int fromRow = (int)floorf((board->topY - fromY) / board->tileHeight);
+    int fromCol = (int)floorf(fromX / board->tileWidth);
+    for (int i = 0; i < count; i++)
+    {
+        int toRow = (int)floorf((board->topY - toY[i]) / board->tileHeight);
+        int toCol = (int)floorf(toX[i] / board->tileWidth);
+        // Targets in the same row only need one masked search of that row
+        if (toRow == fromRow)
+            visible[i] = iFindSolidInRow(board, fromRow, fromCol, toCol) < 0;
+        else
+            visible[i] = iHasLineOfSight(board, fromX, fromY, toX[i], toY[i]);
+        seen += visible[i];
+    }
+    return seen;
+}
@@ -1,5 +1,10 @@
 #include "iGraphics.h"
 #include "iSound.h"
+#include "iTiles.h"
+#include "iLevelStream.h"
+#include "iSnapshot.h"
+#include "iEntity.h"
+#include "iFlowField.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,11 +51,17 @@ int lives = 3;
 char scoreText[100];
 
 // Map
-#define MAX_ROWS 20
-#define MAX_COLS 100
-char map[MAX_ROWS][MAX_COLS];
-int mapRows = 0, mapCols = 0;
+LevelStream level; // the chunks of the current level around the camera
+bool levelStarted = false;
+bool levelReady = false; // the blocks around the ball are loaded
 int blockWidth = 50, blockHeight = 50;
+TileGrid tiles; // collision view over map
+CollectibleIndex items; // the '*' tiles still in the map
+DistanceField field; // distance to the nearest block
+#define MAX_COLLIDERS 1024
+TileRect colliders[MAX_COLLIDERS]; // the blocks of the window merged into rectangles
+int colliderCount = 0; // -1 if they did not fit: the distance field is used instead
+Snapshot levelStart; // the level as it was when it started, for restarts
 Image blockImage; 
 
 // Sounds
@@ -72,24 +83,22 @@ int currentLevel = 1;
 int totalItems = 0;
 int totalLevels = 4;
 
-// Enemy
-typedef struct {
-    float x, y;
-    int dir;  // 1 = right, -1 = left
-    float speed;
-} Enemy;
-Enemy enemy;
+// Enemies ('P'), hazards ('|', 'x') and chasers ('C'), placed by the level's glyphs
+EntityWorld entities;
+int enemies = -1, hazards = -1, chasers = -1; // their archetypes
+FlowField chase; // the way to the ball from the tiles around it
 
 // Function prototypes
 void loadHighScore();
 void saveHighScore();
 void loadMap(const char *filename);
+bool streamLevel();
 void drawMap();
 void updateCamera();
 bool isColliding(float x, float y);
 void updatePhysics();
 void collectItems();
-void updateEnemy();
+void updateEnemies();
 bool checkEnemyCollision();
 void resetLevel();
 void drawUI();
@@ -113,43 +122,108 @@ void saveHighScore() {
 }
 
 void loadMap(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) return;
-    char line[MAX_COLS];
-    mapRows = 0;
-    totalItems = 0;
-    while (fgets(line, sizeof(line), file) && mapRows < MAX_ROWS) {
-        int len = strlen(line);
-        if (line[len - 1] == '\n') line[len - 1] = '\0';
-        strcpy(map[mapRows], line);
-        for (int j = 0; j < strlen(line); j++) {
-            if (line[j] == '@') {
-                ballX = j * blockWidth + blockWidth / 2;
-                ballY = screenHeight - (mapRows + 1) * blockHeight + blockHeight / 2;
-            }
-            if (line[j] == '*') totalItems++;
-        }
-        mapRows++;
+    // Returns at once: the level is opened in the background (from the asset
+    // pack, if one is open) and started by streamLevel() once it is indexed
+    iOpenLevelStream(&level, filename, screenWidth / blockWidth, 32, 2, "P|xC", "*");
+    levelStarted = false;
+    levelReady = false;
+    cameraX = 0;
+}
+
+// Rebuilds the collision data after the window changed; it only covers the loaded columns
+void buildCollision() {
+    iGetStreamTileGrid(&level, &tiles, blockWidth, blockHeight, screenHeight);
+    iBuildCollectiblesFromTiles(&items, &tiles, '*');
+    iBuildDistanceField(&field, &tiles, '#', 4);
+    colliderCount = iGetStreamRects(&level, &tiles, colliders, MAX_COLLIDERS);
+    if (colliderCount > MAX_COLLIDERS) colliderCount = -1;
+}
+
+void startLevel() {
+    totalItems = level.glyphCounts['*'];
+    if (level.startRow >= 0) {
+        ballX = level.startCol * blockWidth + blockWidth / 2;
+        ballY = screenHeight - (level.startRow + 1) * blockHeight + blockHeight / 2;
     }
-    mapCols = strlen(map[0]);
-    fclose(file);
     cameraX = 0;
     ballDY = 0;
 
-    // Initialize enemy on level start (example fixed position)
-    enemy.x = 300;
-    enemy.y = 300;
-    enemy.dir = 1;
-    enemy.speed = 2.0f;
+    // Every enemy and hazard of the level, in arrays sized for it
+    iFreeEntityWorld(&entities);
+    enemies = iAddEntityArchetype(&entities, ENTITY_BOX | ENTITY_VELOCITY | ENTITY_PATROL, level.glyphCounts['P']);
+    hazards = iAddEntityArchetype(&entities, ENTITY_BOX, level.glyphCounts['|'] + level.glyphCounts['x']);
+    iAddEntityKind(&entities, 'P', enemies, 40, 40, 2.0f, 4 * blockWidth);
+    iAddEntityKind(&entities, '|', hazards, 20, blockHeight);
+    iAddEntityKind(&entities, 'x', hazards, blockWidth, blockHeight / 2);
+    chasers = iAddEntityArchetype(&entities, ENTITY_BOX | ENTITY_VELOCITY, level.glyphCounts['C']);
+    iAddEntityKind(&entities, 'C', chasers, 40, 40);
+    iSpawnStreamEntities(&entities, &level, blockWidth, blockHeight, screenHeight);
+    iSortEntities(&entities);
+    // The chasers' way to the ball, within a screen of it
+    iFreeFlowField(&chase);
+    iInitFlowField(&chase, level.rows, screenWidth / blockWidth);
+    levelStarted = true;
+
+    // Everything a restart puts back. The window buffer is new for every
+    // level, so the regions are registered again each time.
+    iClearSnapshotRegions(&levelStart);
+    iAddStreamToSnapshot(&levelStart, &level);
+    iAddSnapshotVariable(&levelStart, totalItems);
+    iAddSnapshotVariable(&levelStart, ballX);
+    iAddSnapshotVariable(&levelStart, ballY);
+    iAddSnapshotVariable(&levelStart, ballDY);
+    iAddSnapshotVariable(&levelStart, onGround);
+    iAddSnapshotVariable(&levelStart, cameraX);
+    iAddEntitiesToSnapshot(&levelStart, &entities);
+    // The collision data too, so only the items are rebuilt on a restart. The
+    // field was built for the whole window, the largest it gets, so its buffer
+    // is not reallocated while this level is open.
+    iAddSnapshotVariable(&levelStart, tiles);
+    iAddSnapshotVariable(&levelStart, field);
+    iAddSnapshotRegion(&levelStart, field.distance, sizeof(float) * field.width * field.height);
+    iAddSnapshotVariable(&levelStart, colliderCount);
+    if (colliderCount > 0) iAddSnapshotRegion(&levelStart, colliders, sizeof(TileRect) * colliderCount);
+    iTakeSnapshot(&levelStart);
+}
+
+// Puts the current level back as it started, without loading it again.
+// Returns false if the level has not started yet.
+bool restartLevel() {
+    if (!levelStarted || !iRestoreSnapshot(&levelStart)) return false;
+    iBuildCollectiblesFromTiles(&items, &tiles, '*');
+    return true;
+}
+
+// Keeps the chunks around the camera loaded. Returns false while the part of
+// the level around the ball is still loading.
+bool streamLevel() {
+    if (!levelStarted && !iIsLevelStreamOpen(&level)) return false;
+    if (iUpdateLevelStream(&level, (int)(cameraX / blockWidth))) {
+        buildCollision();
+    }
+    if (!levelStarted) {
+        // Start once the first window is in, so the snapshot holds all of it
+        if (!iIsStreamWindowLoaded(&level)) return false;
+        startLevel();
+    }
+    int ballCol = (int)(ballX / blockWidth);
+    levelReady = iIsStreamRangeLoaded(&level, ballCol - 1, ballCol + 1);
+    return levelReady;
 }
 
  void drawMap() {
-    for (int i = 0; i < mapRows; i++) {
-        size_t len = strlen(map[i]);
-        for (size_t j = 0; j < len; j++) {
-            if (map[i][j] == '#') {
+    if (!levelStarted) return;
+    // Only the columns on screen
+    int firstCol = (int)(cameraX / blockWidth);
+    int lastCol = (int)((cameraX + screenWidth) / blockWidth);
+    if (firstCol < 0) firstCol = 0;
+    if (lastCol > level.cols - 1) lastCol = level.cols - 1;
+    for (int i = 0; i < level.rows; i++) {
+        for (int j = firstCol; j <= lastCol; j++) {
+            char tile = iGetStreamTile(&level, i, j);
+            if (tile == '#') {
                 iShowImage(j * blockWidth - cameraX, screenHeight - (i + 1) * blockHeight , "block.jpg");
-            } else if (map[i][j] == '*') {
+            } else if (tile == '*') {
                 iSetColor(255, 215, 0);
                 iFilledCircle(j * blockWidth + blockWidth / 2 - cameraX,
                               screenHeight - (i + 1) * blockHeight + blockHeight / 2, 10);
@@ -163,93 +237,111 @@ void loadMap(const char *filename) {
 void updateCamera() {
     cameraX = ballX - screenWidth / 2;
     if (cameraX < 0) cameraX = 0;
-    float maxCameraX = mapCols * blockWidth - screenWidth;
+    float maxCameraX = level.cols * blockWidth - screenWidth;
     if (cameraX > maxCameraX) cameraX = maxCameraX;
 }
 
 bool isColliding(float x, float y) {
-    for (int i = 0; i < mapRows; i++) {
-        for (int j = 0; j < mapCols; j++) {
-            if (map[i][j] == '#') {
-                float bx = j * blockWidth;
-                float by = screenHeight - (i + 1) * blockHeight;
-                if (x + ballRadius > bx && x - ballRadius < bx + blockWidth &&
-                    y + ballRadius > by && y - ballRadius < by + blockHeight) {
-                    return true;
-                }
-            }
-        }
-    }
-    return false;
+    if (!levelReady) return true; // nothing to move on yet
+    // The ball overlaps a block when it touches one of the merged rectangles
+    if (colliderCount >= 0) return iCircleHitsTileRects(&tiles, colliders, colliderCount, x, y, ballRadius);
+    return iSampleDistance(&field, x, y) < ballRadius;
 }
 
 void updatePhysics() {
-    float nextY = ballY + ballDY;
-    if (!isColliding(ballX, nextY)) {
-        ballY = nextY;
-        ballDY += gravity;
-        onGround = false;
-    } else {
+    // Advance through the distance field in steps no longer than the free
+    // space around the ball, so a fast ball stops on the first block instead
+    // of tunnelling through it
+    ballDY += gravity;
+    float time, normalX, normalY;
+    bool hit = iAdvanceCircle(&field, ballX, ballY, ballRadius, 0, ballDY, &time, &normalX, &normalY);
+    ballY += ballDY * time;
+    if (hit) {
         ballDY = 0;
-        onGround = true;
+        onGround = normalY > 0;
+    } else {
+        onGround = false;
     }
 }
 
 void collectItems() {
-    for (int i = 0; i < mapRows; i++) {
-        for (int j = 0; j < mapCols; j++) {
-            if (map[i][j] == '*') {
-                float cx = j * blockWidth + blockWidth / 2;
-                float cy = screenHeight - (i + 1) * blockHeight + blockHeight / 2;
-                float dx = ballX - cx;
-                float dy = ballY - cy;
-                if (sqrt(dx * dx + dy * dy) < ballRadius + 10) {
-                    map[i][j] = '.';
-                    score += 10;
-                    totalItems--;
-
-                    // Play item collection sound
-                   // iPlaySound(itemSound, false);
-
-                    if (totalItems == 0) {
-                        currentLevel++;
-                        if (currentLevel > totalLevels) {
-                            currentState = STATE_VICTORY;
-                            saveHighScore();
-                        } else {
-                            char path[50];
-                            sprintf(path, "maps/level%d.txt", currentLevel);
-                            loadMap(path);
-                        }
-                    }
-                }
+    // Only items in the columns around the ball are tested
+    Collectible collected[8];
+    int count = iCollectNear(&items, ballX, ballY, ballRadius + 10, collected, 8);
+    for (int k = 0; k < count; k++) {
+        iSetStreamTile(&level, collected[k].row, collected[k].col, '.');
+        score += 10;
+        totalItems--;
+
+        // Play item collection sound
+       // iPlaySound(itemSound, false);
+
+        if (totalItems == 0) {
+            currentLevel++;
+            if (currentLevel > totalLevels) {
+                currentState = STATE_VICTORY;
+                saveHighScore();
+            } else {
+                char path[50];
+                sprintf(path, "maps/level%d.txt", currentLevel);
+                loadMap(path);
             }
+            return;
         }
     }
 }
 
-void updateEnemy() {
-    enemy.x += enemy.speed * enemy.dir;
-    // Move enemy back and forth between two X positions (example)
-    float leftBound = 200;
-    float rightBound = 600;
-    if (enemy.x < leftBound) {
-        enemy.x = leftBound;
-        enemy.dir = 1;
-    } else if (enemy.x > rightBound) {
-        enemy.x = rightBound;
-        enemy.dir = -1;
-    }
+void updateEnemies() {
+    // Enemies patrol back and forth around where they were placed. Only those
+    // on screen move every tick; those within a screen of it every 8th tick,
+    // and the rest catch up when the camera gets near them.
+    iUpdateEntitiesAround(&entities, cameraX, cameraX + screenWidth, 2 * blockWidth, screenWidth, 8);
+
+    // Chasers fly to the ball along the flow field, which is searched again
+    // on a worker thread whenever the ball moves to another tile
+    iUpdateFlowField(&chase, &tiles, ballX, ballY);
+    EntityArchetype *chaser = &entities.archetypes[chasers];
+    iFollowFlowField(&chase, chaser->x, chaser->y, chaser->vx, chaser->vy, chaser->count, 1.5f);
 }
 
+// True if the ball touches an enemy or a hazard
 bool checkEnemyCollision() {
-    float dx = fabs(ballX - enemy.x);
-    float dy = fabs(ballY - enemy.y);
-    float collisionDist = ballRadius + 20;  // 20 is enemy size approx
-    if (dx < collisionDist && dy < collisionDist) {
-        return true;
+    float size = 2 * ballRadius;
+    return iCountEntitiesInBox(&entities.archetypes[enemies], ballX, ballY, size, size) +
+           iCountEntitiesInBox(&entities.archetypes[hazards], ballX, ballY, size, size) +
+           iCountEntitiesInBox(&entities.archetypes[chasers], ballX, ballY, size, size) > 0;
+}
+
+// Only the entities on screen
+void drawEntities() {
+    if (!levelStarted) return;
+    int first, last;
+    const EntityArchetype *enemy = &entities.archetypes[enemies];
+    iFindEntityRange(enemy, cameraX, cameraX + screenWidth, &first, &last);
+    iSetColor(255, 0, 0);
+    for (int i = first; i < last; i++) {
+        float left = enemy->x[i] - enemy->width[i] / 2 - cameraX;
+        if (left > screenWidth || left + enemy->width[i] < 0) continue;
+        iFilledRectangle(left, enemy->y[i] - enemy->height[i] / 2, enemy->width[i], enemy->height[i]);
+    }
+    const EntityArchetype *chaser = &entities.archetypes[chasers];
+    iSetColor(160, 0, 200);
+    for (int i = 0; i < chaser->count; i++) {
+        float left = chaser->x[i] - chaser->width[i] / 2 - cameraX;
+        if (left > screenWidth || left + chaser->width[i] < 0) continue;
+        iFilledRectangle(left, chaser->y[i] - chaser->height[i] / 2, chaser->width[i], chaser->height[i]);
+    }
+    const EntityArchetype *hazard = &entities.archetypes[hazards];
+    iFindEntityRange(hazard, cameraX, cameraX + screenWidth, &first, &last);
+    iSetColor(200, 200, 200);
+    for (int i = first; i < last; i++) {
+        float left = hazard->x[i] - hazard->width[i] / 2 - cameraX;
+        if (left > screenWidth || left + hazard->width[i] < 0) continue;
+        double x[3] = {left, left + hazard->width[i] / 2, left + hazard->width[i]};
+        double y[3] = {hazard->y[i] - hazard->height[i] / 2, hazard->y[i] + hazard->height[i] / 2,
+                       hazard->y[i] - hazard->height[i] / 2};
+        iFilledPolygon(x, y, 3);
     }
-    return false;
 }
 
 void resetLevel() {
@@ -259,6 +351,8 @@ void resetLevel() {
     currentLevel = 1;
     char path[50];
     sprintf(path, "maps/level%d.txt", currentLevel);
+    // Restarting the level that is loaded needs no file access
+    if (strcmp(level.filename, path) == 0 && restartLevel()) return;
     loadMap(path);
 }
 
@@ -344,9 +438,8 @@ void iDraw() {
 
         drawMap();
 
-        // Draw enemy as a red square
-        iSetColor(255, 0, 0);
-        iFilledRectangle(enemy.x - 20 - cameraX, enemy.y - 20, 40, 40);
+        // Draw enemies as red squares and hazards as spikes
+        drawEntities();
 
         // Draw ball
         iSetColor(255, 255, 255);
@@ -484,10 +577,11 @@ void iSpecialKeyboard(int key) {
 
 void timer() {
     if (currentState == STATE_GAME) {
+        if (!streamLevel()) return;
         updatePhysics();
         updateCamera();
         collectItems();
-        updateEnemy();
+        updateEnemies();
 
         if (checkEnemyCollision()) {
             lives--;
@@ -516,6 +610,7 @@ int main(int argc, char *argv[]) {
     glutInit(&argc, argv);
 
     iInitializeSound();
+    iOpenAssetPack("assets.pak");
 
     
 iLoadImage(&blockImage, "block.jpg"); 
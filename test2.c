@@ -1,5 +1,11 @@
 #include "iGraphics.h"
 #include "iSound.h"
+#include "iTiles.h"
+#include "iLevelStream.h"
+#include "iSnapshot.h"
+#include "iRewind.h"
+#include "iEntity.h"
+#include "iFlowField.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,11 +16,10 @@
 #define SCREEN_WIDTH 1000
 #define SCREEN_HEIGHT 600
 #define BLOCK_SIZE 50
-#define MAX_ROWS 20
-#define MAX_COLS 100
 #define MAX_NAME_LENGTH 49
 #define TOTAL_LEVELS 4
 #define FPS 60
+#define MAX_COLLIDERS 1024
 
 // Enum for game states
 typedef enum {
@@ -45,9 +50,17 @@ typedef struct {
     // Level info
     int currentLevel;
     int totalItems;
-    char map[MAX_ROWS][MAX_COLS];
-    int mapRows;
-    int mapCols;
+    LevelStream level; // the chunks of the current level around the camera
+    bool levelStarted;
+    bool levelReady; // the blocks around the ball are loaded
+    TileGrid tiles; // collision view over map
+    CollectibleIndex items; // the '*' tiles still in the map
+    DistanceField field; // distance to the nearest block
+    TileRect colliders[MAX_COLLIDERS]; // the blocks of the window merged into rectangles
+    int colliderCount; // -1 if they did not fit: the distance field is used instead
+    Snapshot levelStart; // the level as it was when it started, for restarts
+    Snapshot tickState; // what the rewind history records every tick
+    Rewind rewind; // the last minutes of play, hold Z to go back
     
     // Player physics
     float ballX, ballY;
@@ -59,12 +72,10 @@ typedef struct {
     // Camera
     float cameraX;
     
-    // Enemy
-    struct {
-        float x, y;
-        int dir;
-        float speed;
-    } enemy;
+    // Enemies ('P'), hazards ('|', 'x') and chasers ('C'), placed by the level's glyphs
+    EntityWorld entities;
+    int enemies, hazards, chasers; // their archetypes
+    FlowField chase; // the way to the ball from the tiles around it
     
     // Timer
     int levelTime;
@@ -96,12 +107,13 @@ void initializeGame();
 void loadHighScore();
 void saveHighScore();
 void loadMap(const char *filename);
+bool streamLevel();
 void drawMap();
 void updateCamera();
 bool isColliding(float x, float y);
 void updatePhysics();
 void collectItems();
-void updateEnemy();
+void updateEnemies();
 bool checkEnemyCollision();
 void resetLevel();
 void drawUI();
@@ -129,12 +141,6 @@ void initializeGame() {
     // Initialize camera
     game.cameraX = 0;
     
-    // Initialize enemy
-    game.enemy.x = 300;
-    game.enemy.y = 300;
-    game.enemy.dir = 1;
-    game.enemy.speed = 2.0f;
-    
     // Initialize timer
     game.levelTime = 5 * 60 * FPS; // 5 minutes
     game.currentTime = 0;
@@ -143,6 +149,9 @@ void initializeGame() {
     game.currentLevel = 1;
     game.totalItems = 0;
     
+    // Up to 5 minutes of rewind in at most 4 MB, a keyframe every 5 seconds
+    iInitRewind(&game.rewind, &game.tickState, 4 << 20, 5 * 60 * FPS, 5 * FPS);
+    
     // Load resources
     if (!iLoadImage(&game.blockImage, "block.bmp")) {
         printf("Failed to load block image!\n");
@@ -177,46 +186,149 @@ void saveHighScore() {
 }
 
 void loadMap(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    // Returns at once: the level is opened in the background (from the asset
+    // pack, if one is open) and started by streamLevel() once it is indexed
+    if (!iOpenLevelStream(&game.level, filename, SCREEN_WIDTH / BLOCK_SIZE, 32, 2, "P|xC", "*")) {
         printf("Failed to load map file: %s\n", filename);
-        return;
     }
+    game.levelStarted = false;
+    game.levelReady = false;
+    game.cameraX = 0;
+}
+
+// Rebuilds the collision data after the window changed; it only covers the loaded columns
+void buildCollision() {
+    iGetStreamTileGrid(&game.level, &game.tiles, BLOCK_SIZE, BLOCK_SIZE, SCREEN_HEIGHT);
+    iBuildCollectiblesFromTiles(&game.items, &game.tiles, '*');
+    iBuildDistanceField(&game.field, &game.tiles, '#', 4);
+    game.colliderCount = iGetStreamRects(&game.level, &game.tiles, game.colliders, MAX_COLLIDERS);
+    if (game.colliderCount > MAX_COLLIDERS) game.colliderCount = -1;
+}
+
+void startLevel() {
+    game.totalItems = game.level.glyphCounts['*'];
+    if (game.level.startRow >= 0) {
+        game.ballX = game.level.startCol * BLOCK_SIZE + BLOCK_SIZE / 2;
+        game.ballY = SCREEN_HEIGHT - (game.level.startRow + 1) * BLOCK_SIZE + BLOCK_SIZE / 2;
+    }
+    game.cameraX = 0;
+    game.ballDY = 0;
     
-    char line[MAX_COLS];
-    game.mapRows = 0;
-    game.totalItems = 0;
+    // Every enemy and hazard of the level, in arrays sized for it
+    iFreeEntityWorld(&game.entities);
+    game.enemies = iAddEntityArchetype(&game.entities, ENTITY_BOX | ENTITY_VELOCITY | ENTITY_PATROL, game.level.glyphCounts['P']);
+    game.hazards = iAddEntityArchetype(&game.entities, ENTITY_BOX, game.level.glyphCounts['|'] + game.level.glyphCounts['x']);
+    iAddEntityKind(&game.entities, 'P', game.enemies, 40, 40, 2.0f, 4 * BLOCK_SIZE);
+    iAddEntityKind(&game.entities, '|', game.hazards, 20, BLOCK_SIZE);
+    iAddEntityKind(&game.entities, 'x', game.hazards, BLOCK_SIZE, BLOCK_SIZE / 2);
+    game.chasers = iAddEntityArchetype(&game.entities, ENTITY_BOX | ENTITY_VELOCITY, game.level.glyphCounts['C']);
+    iAddEntityKind(&game.entities, 'C', game.chasers, 40, 40);
+    iSpawnStreamEntities(&game.entities, &game.level, BLOCK_SIZE, BLOCK_SIZE, SCREEN_HEIGHT);
+    iSortEntities(&game.entities);
+    // The chasers' way to the ball, within a screen of it
+    iFreeFlowField(&game.chase);
+    iInitFlowField(&game.chase, game.level.rows, SCREEN_WIDTH / BLOCK_SIZE);
+    game.levelStarted = true;
+
+    // Everything a restart puts back. The window buffer is new for every
+    // level, so the regions are registered again each time.
+    iClearSnapshotRegions(&game.levelStart);
+    iAddStreamToSnapshot(&game.levelStart, &game.level);
+    iAddSnapshotVariable(&game.levelStart, game.totalItems);
+    iAddSnapshotVariable(&game.levelStart, game.ballX);
+    iAddSnapshotVariable(&game.levelStart, game.ballY);
+    iAddSnapshotVariable(&game.levelStart, game.ballDY);
+    iAddSnapshotVariable(&game.levelStart, game.onGround);
+    iAddSnapshotVariable(&game.levelStart, game.cameraX);
+    iAddEntitiesToSnapshot(&game.levelStart, &game.entities);
+    // The collision data too, so only the items are rebuilt on a restart. The
+    // field was built for the whole window, the largest it gets, so its buffer
+    // is not reallocated while this level is open.
+    iAddSnapshotVariable(&game.levelStart, game.tiles);
+    iAddSnapshotVariable(&game.levelStart, game.field);
+    iAddSnapshotRegion(&game.levelStart, game.field.distance, sizeof(float) * game.field.width * game.field.height);
+    iAddSnapshotVariable(&game.levelStart, game.colliderCount);
+    if (game.colliderCount > 0)
+        iAddSnapshotRegion(&game.levelStart, game.colliders, sizeof(TileRect) * game.colliderCount);
+    iTakeSnapshot(&game.levelStart);
+
+    // What changes from tick to tick. The collision data is left out, it is
+    // rebuilt from the window after rewinding.
+    iClearSnapshotRegions(&game.tickState);
+    iAddStreamToSnapshot(&game.tickState, &game.level);
+    iAddSnapshotVariable(&game.tickState, game.score);
+    iAddSnapshotVariable(&game.tickState, game.lives);
+    iAddSnapshotVariable(&game.tickState, game.totalItems);
+    iAddSnapshotVariable(&game.tickState, game.ballX);
+    iAddSnapshotVariable(&game.tickState, game.ballY);
+    iAddSnapshotVariable(&game.tickState, game.ballDY);
+    iAddSnapshotVariable(&game.tickState, game.onGround);
+    iAddSnapshotVariable(&game.tickState, game.cameraX);
+    iAddEntitiesToSnapshot(&game.tickState, &game.entities);
+    iAddSnapshotVariable(&game.tickState, game.currentTime);
+    iClearRewind(&game.rewind);
+}
+
+// Puts the current level back as it started, without loading it again.
+// Returns false if the level has not started yet.
+bool restartLevel() {
+    if (!game.levelStarted || !iRestoreSnapshot(&game.levelStart)) return false;
+    iBuildCollectiblesFromTiles(&game.items, &game.tiles, '*');
+    iClearRewind(&game.rewind);
+    return true;
+}
+
+// Goes back one tick. Only the items are rebuilt, unless the window moved
+// and the rest of the collision data has to follow it.
+void rewindGame() {
+    int firstChunk = game.level.firstChunk;
+    bool resident[MAX_STREAM_CHUNKS];
+    memcpy(resident, game.level.resident, sizeof(resident));
+    if (iRewind(&game.rewind, 1) == 0) return;
     
-    while (fgets(line, sizeof(line), file) && game.mapRows < MAX_ROWS) {
-        // Remove newline character if present
-        line[strcspn(line, "\n")] = '\0';
-        
-        strncpy(game.map[game.mapRows], line, MAX_COLS);
-        
-        for (int j = 0; j < strlen(line); j++) {
-            if (line[j] == '@') {
-                game.ballX = j * BLOCK_SIZE + BLOCK_SIZE / 2;
-                game.ballY = SCREEN_HEIGHT - (game.mapRows + 1) * BLOCK_SIZE + BLOCK_SIZE / 2;
-            }
-            if (line[j] == '*') game.totalItems++;
-        }
-        
-        game.mapRows++;
+    if (game.level.firstChunk != firstChunk || memcmp(resident, game.level.resident, sizeof(resident)) != 0) {
+        buildCollision();
+    } else {
+        iBuildCollectiblesFromTiles(&game.items, &game.tiles, '*');
     }
+}
+
+// Keeps the chunks around the camera loaded. Returns false while the part of
+// the level around the ball is still loading.
+bool streamLevel() {
+    if (!game.levelStarted && !iIsLevelStreamOpen(&game.level)) return false;
     
-    game.mapCols = strlen(game.map[0]);
-    fclose(file);
-    game.cameraX = 0;
-    game.ballDY = 0;
+    if (iUpdateLevelStream(&game.level, (int)(game.cameraX / BLOCK_SIZE))) {
+        buildCollision();
+    }
+    
+    if (!game.levelStarted) {
+        // Start once the first window is in, so the snapshot holds all of it
+        if (!iIsStreamWindowLoaded(&game.level)) return false;
+        startLevel();
+    }
+    
+    int ballCol = (int)(game.ballX / BLOCK_SIZE);
+    game.levelReady = iIsStreamRangeLoaded(&game.level, ballCol - 1, ballCol + 1);
+    return game.levelReady;
 }
 
 void drawMap() {
-    for (int i = 0; i < game.mapRows; i++) {
-        for (int j = 0; j < game.mapCols; j++) {
+    if (!game.levelStarted) return;
+    
+    // Only the columns on screen
+    int firstCol = (int)(game.cameraX / BLOCK_SIZE);
+    int lastCol = (int)((game.cameraX + SCREEN_WIDTH) / BLOCK_SIZE);
+    if (firstCol < 0) firstCol = 0;
+    if (lastCol > game.level.cols - 1) lastCol = game.level.cols - 1;
+    
+    for (int i = 0; i < game.level.rows; i++) {
+        for (int j = firstCol; j <= lastCol; j++) {
             float screenX = j * BLOCK_SIZE - game.cameraX;
             float screenY = SCREEN_HEIGHT - (i + 1) * BLOCK_SIZE;
+            char tile = iGetStreamTile(&game.level, i, j);
             
-            if (game.map[i][j] == '#') {
+            if (tile == '#') {
                 if (game.blockImage.width > 0) {
                     iShowImage(screenX, screenY, game.blockImage);
                 } else {
@@ -224,7 +336,7 @@ void drawMap() {
                     iSetColor(100, 100, 100);
                     iFilledRectangle(screenX, screenY, BLOCK_SIZE, BLOCK_SIZE);
                 }
-            } else if (game.map[i][j] == '*') {
+            } else if (tile == '*') {
                 iSetColor(255, 215, 0);
                 iFilledCircle(j * BLOCK_SIZE + BLOCK_SIZE / 2 - game.cameraX,
                              SCREEN_HEIGHT - (i + 1) * BLOCK_SIZE + BLOCK_SIZE / 2, 
@@ -238,99 +350,119 @@ void updateCamera() {
     game.cameraX = game.ballX - SCREEN_WIDTH / 2;
     if (game.cameraX < 0) game.cameraX = 0;
     
-    float maxCameraX = game.mapCols * BLOCK_SIZE - SCREEN_WIDTH;
+    float maxCameraX = game.level.cols * BLOCK_SIZE - SCREEN_WIDTH;
     if (game.cameraX > maxCameraX) game.cameraX = maxCameraX;
 }
 
 bool isColliding(float x, float y) {
-    for (int i = 0; i < game.mapRows; i++) {
-        for (int j = 0; j < game.mapCols; j++) {
-            if (game.map[i][j] == '#') {
-                float blockX = j * BLOCK_SIZE;
-                float blockY = SCREEN_HEIGHT - (i + 1) * BLOCK_SIZE;
-                
-                if (x + game.ballRadius > blockX && 
-                    x - game.ballRadius < blockX + BLOCK_SIZE &&
-                    y + game.ballRadius > blockY && 
-                    y - game.ballRadius < blockY + BLOCK_SIZE) {
-                    return true;
-                }
-            }
-        }
-    }
-    return false;
+    if (!game.levelReady) return true; // nothing to move on yet
+    // The ball overlaps a block when it touches one of the merged rectangles
+    if (game.colliderCount >= 0)
+        return iCircleHitsTileRects(&game.tiles, game.colliders, game.colliderCount, x, y, game.ballRadius);
+    return iSampleDistance(&game.field, x, y) < game.ballRadius;
 }
 
 void updatePhysics() {
-    float nextY = game.ballY + game.ballDY;
+    // Advance through the distance field in steps no longer than the free
+    // space around the ball, so a fast ball stops on the first block instead
+    // of tunnelling through it
+    game.ballDY += game.gravity;
+    float time, normalX, normalY;
     
-    if (!isColliding(game.ballX, nextY)) {
-        game.ballY = nextY;
-        game.ballDY += game.gravity;
-        game.onGround = false;
-    } else {
+    bool hit = iAdvanceCircle(&game.field, game.ballX, game.ballY, game.ballRadius, 0, game.ballDY,
+                              &time, &normalX, &normalY);
+    game.ballY += game.ballDY * time;
+    
+    if (hit) {
         game.ballDY = 0;
-        game.onGround = true;
+        game.onGround = normalY > 0;
+    } else {
+        game.onGround = false;
     }
 }
 
 void collectItems() {
-    for (int i = 0; i < game.mapRows; i++) {
-        for (int j = 0; j < game.mapCols; j++) {
-            if (game.map[i][j] == '*') {
-                float itemX = j * BLOCK_SIZE + BLOCK_SIZE / 2;
-                float itemY = SCREEN_HEIGHT - (i + 1) * BLOCK_SIZE + BLOCK_SIZE / 2;
-                float dx = game.ballX - itemX;
-                float dy = game.ballY - itemY;
-                float distance = sqrt(dx * dx + dy * dy);
-                
-                if (distance < game.ballRadius + 10) {
-                    game.map[i][j] = '.';
-                    game.score += 10;
-                    game.totalItems--;
-                    
-                    // Play sound if available
-                    // if (game.itemSound) iPlaySound(game.itemSound, false);
-                    
-                    if (game.totalItems == 0) {
-                        game.currentLevel++;
-                        if (game.currentLevel > TOTAL_LEVELS) {
-                            game.currentState = STATE_VICTORY;
-                            saveHighScore();
-                        } else {
-                            char path[50];
-                            sprintf(path, "maps/level%d.txt", game.currentLevel);
-                            loadMap(path);
-                        }
-                    }
-                }
+    // Only items in the columns around the ball are tested, by squared distance
+    Collectible collected[8];
+    int count = iCollectNear(&game.items, game.ballX, game.ballY, game.ballRadius + 10, collected, 8);
+    
+    for (int k = 0; k < count; k++) {
+        iSetStreamTile(&game.level, collected[k].row, collected[k].col, '.');
+        game.score += 10;
+        game.totalItems--;
+        
+        // Play sound if available
+        // if (game.itemSound) iPlaySound(game.itemSound, false);
+        
+        if (game.totalItems == 0) {
+            game.currentLevel++;
+            if (game.currentLevel > TOTAL_LEVELS) {
+                game.currentState = STATE_VICTORY;
+                saveHighScore();
+            } else {
+                char path[50];
+                sprintf(path, "maps/level%d.txt", game.currentLevel);
+                loadMap(path);
             }
+            return;
         }
     }
 }
 
-void updateEnemy() {
-    game.enemy.x += game.enemy.speed * game.enemy.dir;
-    
-    // Simple patrol behavior between 200 and 600
-    float leftBound = 200;
-    float rightBound = 600;
-    
-    if (game.enemy.x < leftBound) {
-        game.enemy.x = leftBound;
-        game.enemy.dir = 1;
-    } else if (game.enemy.x > rightBound) {
-        game.enemy.x = rightBound;
-        game.enemy.dir = -1;
-    }
+void updateEnemies() {
+    // Enemies patrol back and forth around where they were placed. Only those
+    // on screen move every tick; those within a screen of it every 8th tick,
+    // and the rest catch up when the camera gets near them.
+    iUpdateEntitiesAround(&game.entities, game.cameraX, game.cameraX + SCREEN_WIDTH, 2 * BLOCK_SIZE, SCREEN_WIDTH, 8);
+
+    // Chasers fly to the ball along the flow field, which is searched again
+    // on a worker thread whenever the ball moves to another tile
+    iUpdateFlowField(&game.chase, &game.tiles, game.ballX, game.ballY);
+    EntityArchetype *chaser = &game.entities.archetypes[game.chasers];
+    iFollowFlowField(&game.chase, chaser->x, chaser->y, chaser->vx, chaser->vy, chaser->count, 1.5f);
 }
 
+// True if the ball touches an enemy or a hazard
 bool checkEnemyCollision() {
-    float dx = fabs(game.ballX - game.enemy.x);
-    float dy = fabs(game.ballY - game.enemy.y);
-    float collisionDist = game.ballRadius + 20; // Enemy size approx
+    float size = 2 * game.ballRadius;
+    return iCountEntitiesInBox(&game.entities.archetypes[game.enemies], game.ballX, game.ballY, size, size) +
+           iCountEntitiesInBox(&game.entities.archetypes[game.hazards], game.ballX, game.ballY, size, size) +
+           iCountEntitiesInBox(&game.entities.archetypes[game.chasers], game.ballX, game.ballY, size, size) > 0;
+}
+
+// Only the entities on screen
+void drawEntities() {
+    if (!game.levelStarted) return;
+    int first, last;
+    
+    const EntityArchetype *enemy = &game.entities.archetypes[game.enemies];
+    iFindEntityRange(enemy, game.cameraX, game.cameraX + SCREEN_WIDTH, &first, &last);
+    iSetColor(255, 0, 0);
+    for (int i = first; i < last; i++) {
+        float left = enemy->x[i] - enemy->width[i] / 2 - game.cameraX;
+        if (left > SCREEN_WIDTH || left + enemy->width[i] < 0) continue;
+        iFilledRectangle(left, enemy->y[i] - enemy->height[i] / 2, enemy->width[i], enemy->height[i]);
+    }
+    
+    const EntityArchetype *chaser = &game.entities.archetypes[game.chasers];
+    iSetColor(160, 0, 200);
+    for (int i = 0; i < chaser->count; i++) {
+        float left = chaser->x[i] - chaser->width[i] / 2 - game.cameraX;
+        if (left > SCREEN_WIDTH || left + chaser->width[i] < 0) continue;
+        iFilledRectangle(left, chaser->y[i] - chaser->height[i] / 2, chaser->width[i], chaser->height[i]);
+    }
     
-    return (dx < collisionDist && dy < collisionDist);
+    const EntityArchetype *hazard = &game.entities.archetypes[game.hazards];
+    iFindEntityRange(hazard, game.cameraX, game.cameraX + SCREEN_WIDTH, &first, &last);
+    iSetColor(200, 200, 200);
+    for (int i = first; i < last; i++) {
+        float left = hazard->x[i] - hazard->width[i] / 2 - game.cameraX;
+        if (left > SCREEN_WIDTH || left + hazard->width[i] < 0) continue;
+        double x[3] = {left, left + hazard->width[i] / 2, left + hazard->width[i]};
+        double y[3] = {hazard->y[i] - hazard->height[i] / 2, hazard->y[i] + hazard->height[i] / 2,
+                       hazard->y[i] - hazard->height[i] / 2};
+        iFilledPolygon(x, y, 3);
+    }
 }
 
 void resetLevel() {
@@ -341,6 +473,8 @@ void resetLevel() {
     
     char path[50];
     sprintf(path, "maps/level%d.txt", game.currentLevel);
+    // Restarting the level that is loaded needs no file access
+    if (strcmp(game.level.filename, path) == 0 && restartLevel()) return;
     loadMap(path);
 }
 
@@ -440,9 +574,8 @@ void iDraw() {
             
             drawMap();
             
-            // Draw enemy
-            iSetColor(255, 0, 0);
-            iFilledRectangle(game.enemy.x - 20 - game.cameraX, game.enemy.y - 20, 40, 40);
+            // Draw enemies and hazards
+            drawEntities();
             
             // Draw player ball
             iSetColor(255, 255, 255);
@@ -463,6 +596,7 @@ void iDraw() {
             iText(100, 410, "- Avoid the red enemy blocks", GLUT_BITMAP_HELVETICA_18);
             iText(100, 380, "- Press 'P' to pause the game", GLUT_BITMAP_HELVETICA_18);
             iText(100, 350, "- Press 'B' to return to menu", GLUT_BITMAP_HELVETICA_18);
+            iText(100, 320, "- Hold 'Z' to rewind", GLUT_BITMAP_HELVETICA_18);
             
             // Back button
             Button backBtn = {SCREEN_WIDTH/2 - 100, 50, 200, 50, "Back to Menu"};
@@ -687,10 +821,15 @@ void iSpecialKeyboard(int key) {
 
 void timer() {
     if (game.currentState == STATE_GAME) {
+        if (!streamLevel()) return;
+        if (isKeyPressed('z') || isKeyPressed('Z')) {
+            rewindGame();
+            return;
+        }
         updatePhysics();
         updateCamera();
         collectItems();
-        updateEnemy();
+        updateEnemies();
 
         if (checkEnemyCollision()) {
             game.lives--;
@@ -713,6 +852,9 @@ void timer() {
             game.currentState = STATE_GAMEOVER;
             saveHighScore();
         }
+        
+        // Not when an item just finished the level and the next one is loading
+        if (game.levelStarted) iRecordRewindFrame(&game.rewind);
     }
 }
 
@@ -722,6 +864,9 @@ int main(int argc, char *argv[]) {
     // Initialize sound system
     iInitializeSound();
     
+    // Use pre-decoded assets when a pack has been built
+    iOpenAssetPack("assets.pak");
+    
     // Initialize game
     initializeGame();
     
@@ -0,0 +1,138 @@
+//
+//  Compiles level text files into binary levels (see iLevel.h) that the game
+//  loads with a single read.
+//
+//  The '#' tiles are merged greedily into as few solid rectangles as
+//  possible, and every entity glyph (P, c, |, o, G, H, x, B, and any other
+//  glyph that is not '#', '.' or ' ') gets its own spawn list. The tile layer
+//  is kept as it is, so code that reads glyphs keeps working.
+//
+//  Build (from the iGraphics folder):
+//      g++ -O2 -I. tools/iLevelCompiler.cpp -o bin/iLevelCompiler
+//  Usage:
+//      bin/iLevelCompiler level_1.txt level_2.txt
+//
+//  Each input is written next to it with the extension changed to .lvl.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "iLevel.h"
+
+bool isEntityGlyph(char c)
+{
+    return c != '#' && c != '.' && c != ' ';
+}
+
+bool compileLevel(const char *input, const char *output)
+{
+    Level level;
+    memset(&level, 0, sizeof(level));
+    if (!iLoadLevel(&level, input))
+        return false;
+
+    // The solid tiles merged into rectangles, counted first
+    TileGrid grid;
+    iInitTileGrid(&grid, level.cells, level.cols, level.rows, level.cols, 1, 1, 0);
+    std::vector<LevelRect> rects(iMergeSolidTiles(&grid, nullptr, 0));
+    iMergeSolidTiles(&grid, rects.data(), (int)rects.size());
+
+    // Counting sort of the entity tiles by glyph, row-major within a glyph
+    int counts[256] = {0};
+    int solid = 0;
+    size_t cellCount = (size_t)level.rows * level.cols;
+    for (size_t i = 0; i < cellCount; i++)
+    {
+        unsigned char c = level.cells[i];
+        if (c == '#')
+            solid++;
+        else if (isEntityGlyph(c))
+            counts[c]++;
+    }
+    std::vector<LevelSpawnList> lists;
+    int next[256];
+    uint32_t total = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        next[c] = total;
+        if (counts[c] == 0)
+            continue;
+        LevelSpawnList list;
+        memset(&list, 0, sizeof(list));
+        list.glyph = (char)c;
+        list.first = total;
+        list.count = counts[c];
+        lists.push_back(list);
+        total += counts[c];
+    }
+    std::vector<LevelSpawn> spawns(total);
+    for (size_t i = 0; i < cellCount; i++)
+    {
+        unsigned char c = level.cells[i];
+        if (isEntityGlyph(c))
+        {
+            LevelSpawn spawn = {(int32_t)(i / level.cols), (int32_t)(i % level.cols)};
+            spawns[next[c]++] = spawn;
+        }
+    }
+
+    FILE *out = fopen(output, "wb");
+    if (!out)
+    {
+        printf("Failed to create: %s\n", output);
+        iFreeLevel(&level);
+        return false;
+    }
+    LevelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEVEL_MAGIC, 4);
+    header.version = LEVEL_VERSION;
+    header.rows = level.rows;
+    header.cols = level.cols;
+    header.rectCount = rects.size();
+    header.spawnListCount = lists.size();
+    header.spawnCount = total;
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(level.cells, 1, cellCount, out);
+    static const char padding[LEVEL_ALIGN] = {0};
+    fwrite(padding, 1, iLevelTileBytes(level.rows, level.cols) - cellCount, out);
+    fwrite(rects.data(), sizeof(LevelRect), rects.size(), out);
+    fwrite(lists.data(), sizeof(LevelSpawnList), lists.size(), out);
+    fwrite(spawns.data(), sizeof(LevelSpawn), spawns.size(), out);
+    bool written = !ferror(out);
+    fclose(out);
+
+    printf("%s: %d x %d, %d solid tiles in %zu rects, %u spawns of %zu kinds -> %s\n", input, level.rows,
+           level.cols, solid, rects.size(), total, lists.size(), output);
+    iFreeLevel(&level);
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <level.txt>...\n", argv[0]);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        char output[1024];
+        snprintf(output, sizeof(output), "%s", argv[i]);
+        char *dot = strrchr(output, '.');
+        char *slash = strrchr(output, '/');
+        char *backslash = strrchr(output, '\\');
+        if (backslash > slash)
+            slash = backslash;
+        if (dot && (!slash || dot > slash))
+            *dot = '\0';
+        strncat(output, ".lvl", sizeof(output) - strlen(output) - 1);
+        if (!compileLevel(argv[i], output))
+            failed++;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,327 @@
+//
+//  Generates large random levels in the text format of level_1.txt, to see
+//  how loading, streaming, collision and drawing hold up at scale.
+//
+//  The level is made in chunks of 256 columns, each from its own random
+//  sequence derived from the seed and the chunk's index, so the chunks are
+//  generated in parallel and a seed gives the same level on any number of
+//  threads. Every level has a solid floor, ceiling and end walls, the start
+//  '@' at the left and the goal 'G' at the right. Blocks, enemies 'P',
+//  hazards '|' and 'x', chasers 'C' and items '*' are spread evenly over the
+//  chunks on free tiles; patrollers and hazards stand on a block.
+//
+//  Build (from the iGraphics folder):
+//      g++ -O2 -I. tools/iLevelGen.cpp -o bin/iLevelGen -pthread
+//  Usage:
+//      bin/iLevelGen maps/stress.txt --cols 100000 --enemies 10000 --seed 7
+//
+//  Options (default):
+//      --cols N       columns (10000)
+//      --rows N       rows, floor and ceiling included (8)
+//      --enemies N    'P' patrollers (cols / 16)
+//      --hazards N    '|' and 'x' hazards (cols / 20)
+//      --chasers N    'C' chasers (cols / 64)
+//      --items N      '*' items (cols / 8)
+//      --platforms N  floating platforms and pillars per chunk (8)
+//      --seed N       (1)
+//      --threads N    (all hardware threads)
+//
+//  The output can be streamed as it is, compiled with iLevelCompiler or packed with iPacker.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define GEN_CHUNK_WIDTH 256
+#define GEN_START_COLS 5 // kept clear around the start
+
+enum GenKind
+{
+    GEN_ENEMY,
+    GEN_HAZARD,
+    GEN_CHASER,
+    GEN_ITEM,
+    GEN_KIND_COUNT
+};
+
+typedef struct
+{
+    int rows, cols;
+    long long counts[GEN_KIND_COUNT]; // entities of each kind in the whole level
+    int platforms;
+    uint64_t seed;
+    int threads;
+    int chunkCount;
+} GenOptions;
+
+// splitmix64: tiny, fast and good enough to seed each chunk on its own
+uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// In [0, n)
+int randomInt(uint64_t *state, int n)
+{
+    return n > 0 ? (int)(nextRandom(state) % (uint64_t)n) : 0;
+}
+
+// Chunk k's share of `total`, so the shares add up to it exactly
+int chunkShare(long long total, int k, int chunkCount)
+{
+    return (int)(total * (k + 1) / chunkCount - total * k / chunkCount);
+}
+
+// Puts up to `count` glyphs on free tiles of columns c0..c1 - 1, on a block
+// if `grounded`. Gives up on a tile after a few tries, so a full chunk gets
+// fewer. Returns the number placed.
+int placeGlyphs(char *cells, const GenOptions *options, uint64_t *rng, int c0, int c1, char glyph, int count,
+                bool grounded)
+{
+    int cols = options->cols, rows = options->rows;
+    if (c0 < GEN_START_COLS)
+        c0 = GEN_START_COLS;
+    if (c1 > cols - 2)
+        c1 = cols - 2; // leaves the goal and the end wall alone
+    if (c0 >= c1)
+        return 0;
+    int placed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int attempt = 0; attempt < 16; attempt++)
+        {
+            int col = c0 + randomInt(rng, c1 - c0);
+            int row = 1 + randomInt(rng, rows - 2);
+            if (grounded)
+            {
+                // One of the free tiles of the column that stand on a block:
+                // counts them, then walks to the chosen one
+                int standingCount = 0;
+                for (int r = 1; r < rows - 1; r++)
+                {
+                    const char *cell = &cells[(size_t)r * cols + col];
+                    standingCount += *cell == '.' && cell[cols] == '#';
+                }
+                if (standingCount == 0)
+                    continue;
+                int pick = randomInt(rng, standingCount);
+                for (row = 1;; row++)
+                {
+                    const char *cell = &cells[(size_t)row * cols + col];
+                    if (*cell == '.' && cell[cols] == '#' && pick-- == 0)
+                        break;
+                }
+            }
+            char *cell = &cells[(size_t)row * cols + col];
+            if (*cell != '.')
+                continue;
+            *cell = glyph;
+            placed++;
+            break;
+        }
+    }
+    return placed;
+}
+
+// Fills columns chunk * GEN_CHUNK_WIDTH.. of the level; placed[] receives the
+// entities of each kind it holds
+void generateChunk(char *cells, const GenOptions *options, int chunk, int *placed)
+{
+    int rows = options->rows, cols = options->cols;
+    int c0 = chunk * GEN_CHUNK_WIDTH;
+    int c1 = c0 + GEN_CHUNK_WIDTH < cols ? c0 + GEN_CHUNK_WIDTH : cols;
+    uint64_t rng = options->seed * 0x2545F4914F6CDD1Dull + (uint64_t)chunk;
+
+    for (int row = 0; row < rows; row++)
+    {
+        bool wall = row == 0 || row == rows - 1;
+        memset(&cells[(size_t)row * cols + c0], wall ? '#' : '.', c1 - c0);
+    }
+
+    // Floating platforms, and pillars standing on the floor every other time
+    for (int i = 0; i < options->platforms && rows > 4; i++)
+    {
+        int col = c0 + randomInt(&rng, c1 - c0);
+        if (i % 2 == 0)
+        {
+            int row = 2 + randomInt(&rng, rows - 4);
+            int length = 3 + randomInt(&rng, 6);
+            for (int c = col; c < col + length && c < c1; c++)
+                cells[(size_t)row * cols + c] = '#';
+        }
+        else
+        {
+            int height = 1 + randomInt(&rng, rows / 3);
+            int width = 1 + randomInt(&rng, 2);
+            for (int r = rows - 1 - height; r < rows - 1; r++)
+            {
+                for (int c = col; c < col + width && c < c1; c++)
+                    cells[(size_t)r * cols + c] = '#';
+            }
+        }
+    }
+
+    // The ends of the level: walls, a clear start and the goal
+    for (int row = 1; row < rows - 1; row++)
+    {
+        char *line = &cells[(size_t)row * cols];
+        for (int c = c0; c < c1; c++)
+        {
+            if (c == 0 || c == cols - 1)
+                line[c] = '#';
+            else if (c < GEN_START_COLS || c == cols - 2)
+                line[c] = '.';
+        }
+    }
+    if (c0 == 0)
+        cells[(size_t)(rows - 2) * cols + 2] = '@';
+    if (cols - 2 >= c0 && cols - 2 < c1)
+        cells[(size_t)(rows - 2) * cols + cols - 2] = 'G';
+
+    int n = options->chunkCount;
+    int hazards = chunkShare(options->counts[GEN_HAZARD], chunk, n);
+    int spikes = hazards / 2 + randomInt(&rng, 2) * (hazards % 2);
+    placed[GEN_ENEMY] = placeGlyphs(cells, options, &rng, c0, c1, 'P', chunkShare(options->counts[GEN_ENEMY], chunk, n), true);
+    placed[GEN_HAZARD] = placeGlyphs(cells, options, &rng, c0, c1, '|', spikes, true) +
+                         placeGlyphs(cells, options, &rng, c0, c1, 'x', hazards - spikes, true);
+    placed[GEN_CHASER] = placeGlyphs(cells, options, &rng, c0, c1, 'C', chunkShare(options->counts[GEN_CHASER], chunk, n), false);
+    placed[GEN_ITEM] = placeGlyphs(cells, options, &rng, c0, c1, '*', chunkShare(options->counts[GEN_ITEM], chunk, n), false);
+}
+
+// A worker: takes chunks until there are none left
+void generateChunks(char *cells, const GenOptions *options, std::atomic<int> *nextChunk, int *placed)
+{
+    for (int chunk = (*nextChunk)++; chunk < options->chunkCount; chunk = (*nextChunk)++)
+        generateChunk(cells, options, chunk, &placed[(size_t)chunk * GEN_KIND_COUNT]);
+}
+
+bool writeLevel(const char *path, const char *cells, int rows, int cols)
+{
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+        printf("Failed to create: %s\n", path);
+        return false;
+    }
+    bool written = true;
+    for (int row = 0; row < rows && written; row++)
+    {
+        written = fwrite(&cells[(size_t)row * cols], 1, cols, out) == (size_t)cols && fputc('\n', out) != EOF;
+    }
+    written = fclose(out) == 0 && written;
+    if (!written)
+        printf("Failed to write: %s\n", path);
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        printf("Usage: %s <output.txt> [--cols N] [--rows N] [--enemies N] [--hazards N] [--chasers N] [--items N] "
+               "[--platforms N] [--seed N] [--threads N]\n",
+               argv[0]);
+        return 1;
+    }
+
+    GenOptions options;
+    memset(&options, 0, sizeof(options));
+    options.rows = 8;
+    options.cols = 10000;
+    options.platforms = 8;
+    options.seed = 1;
+    options.threads = (int)std::thread::hardware_concurrency();
+    long long counts[GEN_KIND_COUNT] = {-1, -1, -1, -1}; // -1: scale with the columns
+    for (int i = 2; i < argc; i++)
+    {
+        const char *name = argv[i];
+        if (i + 1 >= argc)
+        {
+            printf("Missing value for %s\n", name);
+            return 1;
+        }
+        long long value = strtoll(argv[++i], nullptr, 10);
+        if (strcmp(name, "--cols") == 0)
+            options.cols = (int)value;
+        else if (strcmp(name, "--rows") == 0)
+            options.rows = (int)value;
+        else if (strcmp(name, "--enemies") == 0)
+            counts[GEN_ENEMY] = value;
+        else if (strcmp(name, "--hazards") == 0)
+            counts[GEN_HAZARD] = value;
+        else if (strcmp(name, "--chasers") == 0)
+            counts[GEN_CHASER] = value;
+        else if (strcmp(name, "--items") == 0)
+            counts[GEN_ITEM] = value;
+        else if (strcmp(name, "--platforms") == 0)
+            options.platforms = (int)value;
+        else if (strcmp(name, "--seed") == 0)
+            options.seed = (uint64_t)value;
+        else if (strcmp(name, "--threads") == 0)
+            options.threads = (int)value;
+        else
+        {
+            printf("Unknown option: %s\n", name);
+            return 1;
+        }
+    }
+    if (options.rows < 3 || options.cols < GEN_START_COLS + 3)
+    {
+        printf("A level needs at least 3 rows and %d columns\n", GEN_START_COLS + 3);
+        return 1;
+    }
+    const int perCols[GEN_KIND_COUNT] = {16, 20, 64, 8};
+    for (int k = 0; k < GEN_KIND_COUNT; k++)
+        options.counts[k] = counts[k] >= 0 ? counts[k] : options.cols / perCols[k];
+    options.chunkCount = (options.cols + GEN_CHUNK_WIDTH - 1) / GEN_CHUNK_WIDTH;
+    if (options.threads < 1)
+        options.threads = 1;
+    if (options.threads > options.chunkCount)
+        options.threads = options.chunkCount;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> cells((size_t)options.rows * options.cols);
+    std::vector<int> placed((size_t)options.chunkCount * GEN_KIND_COUNT, 0);
+    std::atomic<int> nextChunk(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < options.threads; t++)
+        workers.emplace_back(generateChunks, cells.data(), &options, &nextChunk, placed.data());
+    for (std::thread &worker : workers)
+        worker.join();
+    auto generated = std::chrono::steady_clock::now();
+
+    if (!writeLevel(argv[1], cells.data(), options.rows, options.cols))
+        return 1;
+    auto written = std::chrono::steady_clock::now();
+
+    long long total[GEN_KIND_COUNT] = {0};
+    for (int chunk = 0; chunk < options.chunkCount; chunk++)
+    {
+        for (int k = 0; k < GEN_KIND_COUNT; k++)
+            total[k] += placed[(size_t)chunk * GEN_KIND_COUNT + k];
+    }
+    printf("%s: %d x %d, %lld enemies, %lld hazards, %lld chasers, %lld items (seed %llu)\n", argv[1], options.rows,
+           options.cols, total[GEN_ENEMY], total[GEN_HAZARD], total[GEN_CHASER], total[GEN_ITEM],
+           (unsigned long long)options.seed);
+    printf("%d chunks on %d threads in %.1f ms, written in %.1f ms\n", options.chunkCount, options.threads,
+           std::chrono::duration<double, std::milli>(generated - start).count(),
+           std::chrono::duration<double, std::milli>(written - generated).count());
+    for (int k = 0; k < GEN_KIND_COUNT; k++)
+    {
+        if (total[k] < options.counts[k])
+        {
+            printf("Only %lld of %lld %s fit; use more columns or rows\n", total[k], options.counts[k],
+                   k == GEN_ENEMY ? "enemies" : k == GEN_HAZARD ? "hazards" : k == GEN_CHASER ? "chasers" : "items");
+        }
+    }
+    return 0;
+}
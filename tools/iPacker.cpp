@@ -0,0 +1,278 @@
+//
+//  Builds an asset pack (see iPack.h) from loose asset files.
+//
+//  Images are decoded to RGBA, bottom row first (the way iLoadImage keeps
+//  them), sounds are converted to the format iInitializeSound() opens the
+//  audio device with, and level text files are stored as padded glyph grids.
+//
+//  Build (from the iGraphics folder):
+//      g++ -O2 -I. -IOpenGL/include -IOpenGL/include/SDL2 tools/iPacker.cpp -o bin/iPacker -lSDL2
+//  Usage:
+//      bin/iPacker assets.pak wallpaper assets block.jpg level_1.txt level_2.txt
+//
+//  Folders are added recursively. Entry names are the paths as given on the
+//  command line, so run it from the folder the game runs in.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#define SDL_MAIN_HANDLED // plain main(), no SDL2main needed
+#include <SDL.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "iPack.h"
+
+// Must match Mix_OpenAudio() in iInitializeSound()
+#define PACK_AUDIO_FREQUENCY 44100
+#define PACK_AUDIO_FORMAT AUDIO_S16SYS
+#define PACK_AUDIO_CHANNELS 2
+
+#define MAX_PACK_ENTRIES 4096
+
+PackEntry entries[MAX_PACK_ENTRIES];
+int entryCount = 0;
+FILE *out;
+
+bool hasExtension(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    if (!dot)
+        return false;
+    for (int i = 0;; i++)
+    {
+        if (tolower((unsigned char)dot[1 + i]) != ext[i])
+            return false;
+        if (ext[i] == '\0')
+            return true;
+    }
+}
+
+// Appends a blob on a PACK_ALIGN boundary and records it in the index
+void addEntry(const char *path, int type, const void *data, size_t size, int p0, int p1, int p2)
+{
+    if (entryCount >= MAX_PACK_ENTRIES)
+    {
+        printf("Too many entries, skipping: %s\n", path);
+        return;
+    }
+
+    long pos = ftell(out);
+    static const char zeros[PACK_ALIGN] = {0};
+    fwrite(zeros, 1, (PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN, out);
+
+    PackEntry *entry = &entries[entryCount++];
+    memset(entry, 0, sizeof(PackEntry));
+    iNormalizePackName(path, entry->name);
+    entry->type = type;
+    entry->offset = ftell(out);
+    entry->size = size;
+    entry->params[0] = p0;
+    entry->params[1] = p1;
+    entry->params[2] = p2;
+    fwrite(data, 1, size, out);
+    printf("  %-48s %8zu bytes\n", entry->name, size);
+}
+
+void packImage(const char *path)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char *pixels = stbi_load(path, &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        printf("Failed to load image: %s (%s)\n", path, stbi_failure_reason());
+        return;
+    }
+    addEntry(path, PACK_IMAGE, pixels, (size_t)width * height * 4, width, height, 4);
+    stbi_image_free(pixels);
+}
+
+void packSound(const char *path)
+{
+    SDL_AudioSpec spec;
+    Uint8 *buffer;
+    Uint32 length;
+    if (!SDL_LoadWAV(path, &spec, &buffer, &length))
+    {
+        printf("Failed to load sound: %s (%s)\n", path, SDL_GetError());
+        return;
+    }
+
+    SDL_AudioCVT cvt;
+    SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+                      PACK_AUDIO_FORMAT, PACK_AUDIO_CHANNELS, PACK_AUDIO_FREQUENCY);
+    cvt.len = length;
+    cvt.buf = (Uint8 *)SDL_malloc(length * cvt.len_mult);
+    memcpy(cvt.buf, buffer, length);
+    SDL_FreeWAV(buffer);
+    if (cvt.needed && SDL_ConvertAudio(&cvt) < 0)
+    {
+        printf("Failed to convert sound: %s (%s)\n", path, SDL_GetError());
+        SDL_free(cvt.buf);
+        return;
+    }
+
+    int converted = cvt.needed ? cvt.len_cvt : cvt.len;
+    addEntry(path, PACK_SOUND, cvt.buf, converted, PACK_AUDIO_FREQUENCY, PACK_AUDIO_FORMAT, PACK_AUDIO_CHANNELS);
+    SDL_free(cvt.buf);
+}
+
+void packLevel(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("Failed to open level: %s\n", path);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = (char *)malloc(size + 1);
+    size = fread(text, 1, size, file);
+    text[size] = '\0';
+    fclose(file);
+
+    // Measure, then copy each line into a rows x cols grid padded with '.'
+    int rows = 0, cols = 0, width = 0;
+    for (long i = 0; i <= size; i++)
+    {
+        if (i == size || text[i] == '\n')
+        {
+            if (width > 0 || i < size)
+                rows++;
+            if (width > cols)
+                cols = width;
+            width = 0;
+        }
+        else if (text[i] != '\r')
+        {
+            width++;
+        }
+    }
+
+    char *grid = (char *)malloc((size_t)rows * cols + 1);
+    memset(grid, '.', (size_t)rows * cols);
+    int row = 0, col = 0;
+    for (long i = 0; i < size && row < rows; i++)
+    {
+        if (text[i] == '\n')
+        {
+            row++;
+            col = 0;
+        }
+        else if (text[i] != '\r')
+        {
+            grid[(size_t)row * cols + col++] = text[i];
+        }
+    }
+
+    addEntry(path, PACK_LEVEL, grid, (size_t)rows * cols, rows, cols, 0);
+    free(grid);
+    free(text);
+}
+
+void packPath(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        printf("Not found: %s\n", path);
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path);
+        if (!dir)
+            return;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            char child[1024];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            packPath(child);
+        }
+        closedir(dir);
+    }
+    else if (hasExtension(path, "bmp") || hasExtension(path, "png") || hasExtension(path, "jpg") ||
+             hasExtension(path, "jpeg") || hasExtension(path, "gif") || hasExtension(path, "tga"))
+    {
+        packImage(path);
+    }
+    else if (hasExtension(path, "wav"))
+    {
+        packSound(path);
+    }
+    else if (hasExtension(path, "txt"))
+    {
+        packLevel(path);
+    }
+}
+
+int compareEntries(const void *a, const void *b)
+{
+    return strcmp(((const PackEntry *)a)->name, ((const PackEntry *)b)->name);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s <output.pak> <file or folder>...\n", argv[0]);
+        return 1;
+    }
+
+    out = fopen(argv[1], "wb");
+    if (!out)
+    {
+        printf("Failed to create: %s\n", argv[1]);
+        return 1;
+    }
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, out);
+
+    for (int i = 2; i < argc; i++)
+    {
+        packPath(argv[i]);
+    }
+
+    // The reader binary-searches the index, so names must be sorted and unique
+    qsort(entries, entryCount, sizeof(PackEntry), compareEntries);
+    for (int i = 1; i < entryCount; i++)
+    {
+        if (strcmp(entries[i - 1].name, entries[i].name) == 0)
+        {
+            printf("Duplicate entry: %s (listed twice or found in two places)\n", entries[i].name);
+            fclose(out);
+            remove(argv[1]);
+            return 1;
+        }
+    }
+
+    long pos = ftell(out);
+    static const char zeros[PACK_ALIGN] = {0};
+    fwrite(zeros, 1, (PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN, out);
+
+    memcpy(header.magic, PACK_MAGIC, 4);
+    header.version = PACK_VERSION;
+    header.entryCount = entryCount;
+    header.alignment = PACK_ALIGN;
+    header.indexOffset = ftell(out);
+    fwrite(entries, sizeof(PackEntry), entryCount, out);
+
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    fclose(out);
+
+    printf("Packed %d assets into %s\n", entryCount, argv[1]);
+    return 0;
+}